@@ -0,0 +1,207 @@
+#include "InstrumentCache.h"
+#include "InstrumentConfig.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace fs = std::filesystem;
+
+// The file is only read back by the machine that wrote it, so fields are
+// stored in native byte order.
+struct InstrumentCache::Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_count;
+    int64_t ini_mtime;
+    uint64_t ini_size;
+    int32_t next_custom_wave_id;
+    uint32_t strings_size;
+};
+
+struct InstrumentCache::Record {
+    uint64_t fingerprint_hi;
+    uint64_t fingerprint_lo;
+    int32_t midi_instrument;
+    // Offset/length pairs into the string blob
+    uint32_t name_offset, name_length;
+    uint32_t source_offset, source_length;
+    uint32_t registered_offset, registered_length;
+    uint32_t graph_offset, graph_length;
+    uint32_t reserved; // Keeps the record free of implicit padding
+};
+
+static const char CACHE_MAGIC[8] = {'W', 'S', 'I', 'N', 'S', 'T', 'D', 'B'};
+static const uint32_t CACHE_VERSION = 1;
+
+bool InstrumentIniStamp::of_file(const std::string& filename, InstrumentIniStamp& out) {
+    std::error_code ec;
+    auto mtime = fs::last_write_time(filename, ec);
+    if (ec) return false;
+    auto size = fs::file_size(filename, ec);
+    if (ec) return false;
+    out.mtime = static_cast<int64_t>(mtime.time_since_epoch().count());
+    out.size = static_cast<uint64_t>(size);
+    return true;
+}
+
+bool InstrumentCache::open(const std::string& cache_filename, const InstrumentIniStamp& stamp) {
+    static_assert(sizeof(Header) % alignof(Record) == 0, "records must stay aligned after the header");
+    close();
+    if (!file.open(cache_filename)) return false;
+
+    ByteView view = file.view();
+    if (view.size() < sizeof(Header)) {
+        close();
+        return false;
+    }
+    Header header;
+    std::memcpy(&header, view.data(), sizeof(Header));
+    size_t records_size = static_cast<size_t>(header.record_count) * sizeof(Record);
+    if (std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 ||
+        header.version != CACHE_VERSION ||
+        header.ini_mtime != stamp.mtime || header.ini_size != stamp.size ||
+        view.size() != sizeof(Header) + records_size + header.strings_size) {
+        close();
+        return false;
+    }
+
+    records = reinterpret_cast<const Record*>(view.data() + sizeof(Header));
+    record_count = header.record_count;
+    strings = reinterpret_cast<const char*>(view.data() + sizeof(Header) + records_size);
+    next_custom_wave_id = header.next_custom_wave_id;
+
+    // Reject offsets that point outside the blob rather than trusting the file.
+    for (size_t i = 0; i < record_count; ++i) {
+        const Record& r = records[i];
+        auto fits = [&](uint32_t offset, uint32_t length) {
+            return static_cast<uint64_t>(offset) + length <= header.strings_size;
+        };
+        if (!fits(r.name_offset, r.name_length) || !fits(r.source_offset, r.source_length) ||
+            !fits(r.registered_offset, r.registered_length) || !fits(r.graph_offset, r.graph_length)) {
+            close();
+            return false;
+        }
+    }
+    return true;
+}
+
+void InstrumentCache::close() {
+    file.close();
+    records = nullptr;
+    record_count = 0;
+    strings = nullptr;
+    next_custom_wave_id = 1;
+}
+
+const InstrumentCache::Record* InstrumentCache::find_record(const WaveFingerprint& fingerprint) const {
+    if (records == nullptr) return nullptr;
+    const Record* end = records + record_count;
+    const Record* it = std::lower_bound(records, end, fingerprint, [](const Record& r, const WaveFingerprint& fp) {
+        return r.fingerprint_hi != fp.hi ? r.fingerprint_hi < fp.hi : r.fingerprint_lo < fp.lo;
+    });
+    if (it == end || it->fingerprint_hi != fingerprint.hi || it->fingerprint_lo != fingerprint.lo) {
+        return nullptr;
+    }
+    return it;
+}
+
+bool InstrumentCache::find_midi_instrument(const WaveFingerprint& fingerprint, int& midi_instrument) const {
+    const Record* record = find_record(fingerprint);
+    if (record == nullptr) return false;
+    midi_instrument = record->midi_instrument;
+    return true;
+}
+
+void InstrumentCache::decode_record(const Record& record, InstrumentInfo& info) const {
+    info.fingerprint.hi = record.fingerprint_hi;
+    info.fingerprint.lo = record.fingerprint_lo;
+    info.midi_instrument = record.midi_instrument;
+    info.name.assign(strings + record.name_offset, record.name_length);
+    info.source.assign(strings + record.source_offset, record.source_length);
+    info.registered_at.assign(strings + record.registered_offset, record.registered_length);
+    info.graph.assign(strings + record.graph_offset, record.graph_length);
+}
+
+bool InstrumentCache::find_instrument(const WaveFingerprint& fingerprint, InstrumentInfo& info) const {
+    const Record* record = find_record(fingerprint);
+    if (record == nullptr) return false;
+    decode_record(*record, info);
+    return true;
+}
+
+std::vector<InstrumentInfo> InstrumentCache::read_all() const {
+    std::vector<InstrumentInfo> all(record_count);
+    for (size_t i = 0; i < record_count; ++i) {
+        decode_record(records[i], all[i]);
+    }
+    return all;
+}
+
+bool InstrumentCache::write(const std::string& cache_filename, const InstrumentIniStamp& stamp,
+                            const std::vector<InstrumentInfo>& instruments, int next_custom_wave_id) {
+    std::vector<const InstrumentInfo*> sorted;
+    sorted.reserve(instruments.size());
+    for (const auto& info : instruments) sorted.push_back(&info);
+    std::sort(sorted.begin(), sorted.end(), [](const InstrumentInfo* a, const InstrumentInfo* b) {
+        return a->fingerprint < b->fingerprint;
+    });
+
+    std::vector<Record> records;
+    records.reserve(sorted.size());
+    std::string blob;
+    auto add_string = [&blob](const std::string& text, uint32_t& offset, uint32_t& length) {
+        offset = static_cast<uint32_t>(blob.size());
+        length = static_cast<uint32_t>(text.size());
+        blob += text;
+    };
+    for (const InstrumentInfo* info : sorted) {
+        Record r{};
+        r.fingerprint_hi = info->fingerprint.hi;
+        r.fingerprint_lo = info->fingerprint.lo;
+        r.midi_instrument = info->midi_instrument;
+        add_string(info->name, r.name_offset, r.name_length);
+        add_string(info->source, r.source_offset, r.source_length);
+        add_string(info->registered_at, r.registered_offset, r.registered_length);
+        add_string(info->graph, r.graph_offset, r.graph_length);
+        records.push_back(r);
+    }
+
+    Header header{};
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.record_count = static_cast<uint32_t>(records.size());
+    header.ini_mtime = stamp.mtime;
+    header.ini_size = stamp.size;
+    header.next_custom_wave_id = next_custom_wave_id;
+    header.strings_size = static_cast<uint32_t>(blob.size());
+
+    std::string temp_filename = cache_filename + ".tmp";
+    {
+        std::ofstream outfile(temp_filename, std::ios::binary);
+        if (!outfile.is_open()) {
+            std::cerr << "Warning: Could not write instrument cache: " << temp_filename << std::endl;
+            return false;
+        }
+        outfile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        outfile.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(Record));
+        outfile.write(blob.data(), blob.size());
+        outfile.close();
+        if (outfile.fail()) {
+            std::cerr << "Warning: Could not write instrument cache: " << temp_filename << std::endl;
+            std::remove(temp_filename.c_str());
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    fs::rename(temp_filename, cache_filename, ec);
+    if (ec) {
+        std::cerr << "Warning: Could not replace instrument cache " << cache_filename << ": " << ec.message() << std::endl;
+        std::remove(temp_filename.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,55 @@
+#ifndef INSTRUMENT_CACHE_H
+#define INSTRUMENT_CACHE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "MappedFile.h"
+#include "WaveFingerprint.h"
+
+struct InstrumentInfo;
+
+// Identifies the instruments.ini a cache was compiled from.
+struct InstrumentIniStamp {
+    int64_t mtime = 0;
+    uint64_t size = 0;
+
+    static bool of_file(const std::string& filename, InstrumentIniStamp& out);
+};
+
+// Compiled, memory-mapped form of instruments.ini. A header is followed by
+// fixed-size records sorted by fingerprint and a blob holding the text fields,
+// so opening it costs one mmap and lookups are a binary search.
+class InstrumentCache {
+public:
+    // Returns false if the cache is missing, malformed, or was compiled from a
+    // different version of the .ini (mtime or size changed).
+    bool open(const std::string& cache_filename, const InstrumentIniStamp& stamp);
+    void close();
+    bool is_open() const { return records != nullptr; }
+
+    size_t size() const { return record_count; }
+    int get_next_custom_wave_id() const { return next_custom_wave_id; }
+    bool find_midi_instrument(const WaveFingerprint& fingerprint, int& midi_instrument) const;
+    bool find_instrument(const WaveFingerprint& fingerprint, InstrumentInfo& info) const;
+    std::vector<InstrumentInfo> read_all() const;
+
+    static bool write(const std::string& cache_filename, const InstrumentIniStamp& stamp,
+                      const std::vector<InstrumentInfo>& instruments, int next_custom_wave_id);
+
+private:
+    struct Header;
+    struct Record;
+
+    const Record* find_record(const WaveFingerprint& fingerprint) const;
+    void decode_record(const Record& record, InstrumentInfo& info) const;
+
+    MappedFile file;
+    const Record* records = nullptr;
+    size_t record_count = 0;
+    const char* strings = nullptr;
+    int next_custom_wave_id = 1;
+};
+
+#endif // INSTRUMENT_CACHE_H
@@ -9,6 +9,14 @@
 #include <cmath>
 #include <chrono>
 #include <ctime>
+#include <cstdio>
+#include <mutex>
+#include <filesystem>
+#include <thread>
+#include "ThreadPool.h"
+
+// Waveforms differing in at most this many samples are grouped by -s.
+static const int SIMILARITY_THRESHOLD = 6;
 
 // Helper to trim whitespace from both ends of a string
 std::string trim(const std::string& s) {
@@ -19,7 +27,12 @@ std::string trim(const std::string& s) {
 }
 
 InstrumentConfig::InstrumentConfig(const std::string& filename, UsageLogger& logger)
-    : config_filename(filename), usage_logger(logger), next_custom_wave_id(1) {}
+    : config_filename(filename), cache_filename(filename + ".cache"), usage_logger(logger), next_custom_wave_id(1) {}
+
+InstrumentConfig::~InstrumentConfig() {
+    // Last chance for registrations made by a run that did not flush explicitly.
+    flush();
+}
 
 std::string InstrumentConfig::get_current_timestamp() {
     auto now = std::chrono::system_clock::now();
@@ -41,7 +54,7 @@ void InstrumentConfig::populate_with_defaults() {
         std::array<uint8_t, 32> wave_array;
         std::copy_n(pair.second.wave_data.begin(), 32, wave_array.begin());
         
-        info.fingerprint = generate_fingerprint(wave_array);
+        info.fingerprint = WaveFingerprint::from_samples(wave_array);
         info.graph = generate_waveform_graph(wave_array);
         
         if (instruments.find(info.fingerprint) == instruments.end()) {
@@ -51,17 +64,33 @@ void InstrumentConfig::populate_with_defaults() {
 }
 
 void InstrumentConfig::load() {
+    instruments.clear();
+    cache.close();
+    next_custom_wave_id = 1;
+    waveform_index.clear();
+    canonical_waveforms.clear();
+    waveform_index_built = false;
+    similar_waveforms.clear();
+
+    // Fast path: the compiled cache is still in sync with the .ini.
+    InstrumentIniStamp stamp;
+    if (InstrumentIniStamp::of_file(config_filename, stamp) && cache.open(cache_filename, stamp)) {
+        next_custom_wave_id = cache.get_next_custom_wave_id();
+        return;
+    }
+
     std::ifstream infile(config_filename);
     if (!infile.is_open()) {
         // File doesn't exist, populate with defaults and save a new one.
         populate_with_defaults();
-        save();
+        save_unlocked();
         return;
     }
 
     std::string line;
     InstrumentInfo current_instrument;
     std::string current_name;
+    bool has_fingerprint = false;
     bool in_graph = false;
 
     while (std::getline(infile, line)) {
@@ -79,11 +108,12 @@ void InstrumentConfig::load() {
         if (trimmed_line.empty() || trimmed_line[0] == ';') continue;
 
         if (trimmed_line[0] == '[' && trimmed_line.back() == ']') {
-            if (!current_name.empty() && !current_instrument.fingerprint.empty()) {
+            if (!current_name.empty() && has_fingerprint) {
                 instruments[current_instrument.fingerprint] = current_instrument;
             }
             current_name = trimmed_line.substr(1, trimmed_line.length() - 2);
             current_instrument = InstrumentInfo{};
+            has_fingerprint = false;
             current_instrument.name = current_name;
             in_graph = false;
         } else {
@@ -94,7 +124,12 @@ void InstrumentConfig::load() {
             key = trim(key);
             value = trim(value);
 
-            if (key == "fingerprint") current_instrument.fingerprint = value;
+            if (key == "fingerprint") {
+                has_fingerprint = WaveFingerprint::from_hex(value, current_instrument.fingerprint);
+                if (!has_fingerprint) {
+                    std::cerr << "Warning: Ignoring [" << current_name << "] with invalid fingerprint: " << value << std::endl;
+                }
+            }
             else if (key == "midi_instrument") current_instrument.midi_instrument = std::stoi(value);
             else if (key == "source") current_instrument.source = value;
             else if (key == "registered_at") current_instrument.registered_at = value;
@@ -107,13 +142,14 @@ void InstrumentConfig::load() {
             }
         }
     }
-    if (!current_name.empty() && !current_instrument.fingerprint.empty()) {
+    if (!current_name.empty() && has_fingerprint) {
         instruments[current_instrument.fingerprint] = current_instrument;
     }
     
     if (instruments.empty()) {
         populate_with_defaults();
-        save();
+        save_unlocked();
+        return;
     }
 
     for(const auto& pair : instruments) {
@@ -124,19 +160,47 @@ void InstrumentConfig::load() {
             } catch (...) {}
         }
     }
+
+    std::vector<InstrumentInfo> all_instruments;
+    for (const auto& pair : instruments) {
+        all_instruments.push_back(pair.second);
+    }
+    write_cache_unlocked(all_instruments);
 }
 
-void InstrumentConfig::save() {
-    std::ofstream outfile(config_filename);
-    if (!outfile.is_open()) {
-        std::cerr << "Error: Could not open instrument config for writing: " << config_filename << std::endl;
-        return;
+void InstrumentConfig::materialize_cache_unlocked() {
+    // Pull every cached entry into the map so the whole set can be rewritten.
+    // The mapping is released first thing, as Windows cannot replace a mapped file.
+    if (!cache.is_open()) return;
+    for (auto& info : cache.read_all()) {
+        instruments.emplace(info.fingerprint, std::move(info));
+    }
+    cache.close();
+}
+
+void InstrumentConfig::write_cache_unlocked(const std::vector<InstrumentInfo>& all_instruments) {
+    InstrumentIniStamp stamp;
+    if (!InstrumentIniStamp::of_file(config_filename, stamp)) return;
+    cache.close();
+
+    // Store entries exactly as load() would read them back from the .ini, so
+    // the cache and a fresh parse are interchangeable.
+    std::vector<InstrumentInfo> as_loaded(all_instruments);
+    for (auto& info : as_loaded) {
+        info.source = trim(info.source);
+        info.registered_at = trim(info.registered_at);
+        if (info.graph.empty() || info.graph.back() != '\n') info.graph += "\n";
     }
+    InstrumentCache::write(cache_filename, stamp, as_loaded, next_custom_wave_id);
+}
+
+void InstrumentConfig::save() {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    save_unlocked();
+}
 
-    outfile << "; Instrument configuration for vgm_ws_to_mid" << std::endl;
-    outfile << "; This file is auto-generated and managed by the converter." << std::endl;
-    outfile << "; You can manually edit the 'midi_instrument' for any entry." << std::endl;
-    outfile << std::endl;
+void InstrumentConfig::save_unlocked() {
+    materialize_cache_unlocked();
 
     // Create a vector to sort the instruments for consistent output order
     std::vector<InstrumentInfo> sorted_instruments;
@@ -147,105 +211,167 @@ void InstrumentConfig::save() {
         return a.name < b.name;
     });
 
-    for (const auto& info : sorted_instruments) {
-        outfile << "[" << info.name << "]" << std::endl;
-        outfile << "fingerprint = " << info.fingerprint << std::endl;
-        outfile << "midi_instrument = " << info.midi_instrument << std::endl;
-        outfile << "source = " << info.source << std::endl;
-        outfile << "registered_at = " << info.registered_at << std::endl;
-        outfile << "graph =" << info.graph; // Graph includes its own newlines
+    if (write_instruments(sorted_instruments)) {
+        dirty = false;
+    }
+}
+
+void InstrumentConfig::flush() {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    if (dirty) {
+        save_unlocked();
+    }
+}
+
+bool InstrumentConfig::write_instruments(const std::vector<InstrumentInfo>& ordered_instruments) {
+    // Write next to the real file and rename over it, so an interrupted run
+    // leaves either the old or the new configuration, never a truncated one.
+    std::string temp_filename = config_filename + ".tmp";
+    {
+        std::ofstream outfile(temp_filename);
+        if (!outfile.is_open()) {
+            std::cerr << "Error: Could not open instrument config for writing: " << temp_filename << std::endl;
+            return false;
+        }
+
+        outfile << "; Instrument configuration for vgm_ws_to_mid" << std::endl;
+        outfile << "; This file is auto-generated and managed by the converter." << std::endl;
+        outfile << "; You can manually edit the 'midi_instrument' for any entry." << std::endl;
         outfile << std::endl;
+
+        for (const auto& info : ordered_instruments) {
+            outfile << "[" << info.name << "]" << std::endl;
+            outfile << "fingerprint = " << info.fingerprint.to_hex() << std::endl;
+            outfile << "midi_instrument = " << info.midi_instrument << std::endl;
+            outfile << "source = " << info.source << std::endl;
+            outfile << "registered_at = " << info.registered_at << std::endl;
+            outfile << "graph =" << info.graph; // Graph includes its own newlines
+            outfile << std::endl;
+        }
+
+        outfile.close();
+        if (outfile.fail()) {
+            std::cerr << "Error: Failed to write instrument config: " << temp_filename << std::endl;
+            std::remove(temp_filename.c_str());
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(temp_filename, config_filename, ec);
+    if (ec) {
+        std::cerr << "Error: Could not replace " << config_filename << ": " << ec.message() << std::endl;
+        std::remove(temp_filename.c_str());
+        return false;
     }
+
+    write_cache_unlocked(ordered_instruments);
+    return true;
 }
 
 void InstrumentConfig::sort_and_save() {
+    materialize_cache_unlocked();
     if (instruments.empty()) {
         return;
     }
 
-    // Helper to decode fingerprint string to wave array
-    auto decode_fingerprint = [](const std::string& fp) {
-        std::array<uint8_t, 32> wave;
-        for(size_t i = 0; i < 32; ++i) {
-            std::string byte_str = fp.substr(i * 2, 2);
-            wave[i] = static_cast<uint8_t>(std::stoul(byte_str, nullptr, 16));
+    // Name order makes the clustering independent of the hash map's layout.
+    std::vector<const InstrumentInfo*> all_instruments;
+    all_instruments.reserve(instruments.size());
+    for (const auto& pair : instruments) {
+        all_instruments.push_back(&pair.second);
+    }
+    std::sort(all_instruments.begin(), all_instruments.end(), [](const InstrumentInfo* a, const InstrumentInfo* b) {
+        return a->name < b->name;
+    });
+
+    WaveformIndex index;
+    for (const InstrumentInfo* info : all_instruments) {
+        index.add(info->fingerprint, info->name);
+    }
+
+    // The neighbour lists are independent of each other, so they are found in parallel.
+    size_t count = all_instruments.size();
+    std::vector<std::vector<uint32_t>> neighbours(count);
+    auto find_neighbours = [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i) {
+            index.find_within(all_instruments[i]->fingerprint, SIMILARITY_THRESHOLD, neighbours[i]);
         }
-        return wave;
     };
-
-    std::vector<InstrumentInfo> all_instruments;
-    for(const auto& pair : instruments) {
-        all_instruments.push_back(pair.second);
+    const size_t chunk_size = 256;
+    size_t num_threads = std::min<size_t>(std::max(1u, std::thread::hardware_concurrency()),
+                                          (count + chunk_size - 1) / chunk_size);
+    if (num_threads <= 1) {
+        find_neighbours(0, count);
+    } else {
+        ThreadPool pool(num_threads);
+        for (size_t first = 0; first < count; first += chunk_size) {
+            pool.submit([&, first] { find_neighbours(first, std::min(count, first + chunk_size)); });
+        }
+        pool.wait_idle();
     }
 
+    // Greedy clustering: each waveform not yet placed starts a cluster and
+    // takes every unplaced waveform similar to it.
     std::vector<InstrumentInfo> sorted_instruments;
-    std::vector<bool> processed(all_instruments.size(), false);
-    
-    for (size_t i = 0; i < all_instruments.size(); ++i) {
+    sorted_instruments.reserve(count);
+    std::vector<bool> processed(count, false);
+    for (size_t i = 0; i < count; ++i) {
         if (processed[i]) continue;
-
-        std::vector<InstrumentInfo> cluster;
-        cluster.push_back(all_instruments[i]);
-        processed[i] = true;
-        
-        std::array<uint8_t, 32> representative_wave = decode_fingerprint(all_instruments[i].fingerprint);
-
-        for (size_t j = i + 1; j < all_instruments.size(); ++j) {
-            if (processed[j]) continue;
-            
-            std::array<uint8_t, 32> candidate_wave = decode_fingerprint(all_instruments[j].fingerprint);
-            if (are_waveforms_similar(representative_wave, candidate_wave, 6)) {
-                cluster.push_back(all_instruments[j]);
+        // Neighbour lists are ascending, and names ascend with the index, so
+        // the cluster comes out sorted by name.
+        for (uint32_t j : neighbours[i]) {
+            if (!processed[j]) {
                 processed[j] = true;
+                sorted_instruments.push_back(*all_instruments[j]);
             }
         }
-
-        std::sort(cluster.begin(), cluster.end(), [](const InstrumentInfo& a, const InstrumentInfo& b){
-            return a.name < b.name;
-        });
-
-        for(const auto& info : cluster) {
-            sorted_instruments.push_back(info);
-        }
     }
 
-    // Overwrite the file with the sorted list
-    std::ofstream outfile(config_filename);
-    if (!outfile.is_open()) {
-        std::cerr << "Error: Could not open instrument config for writing: " << config_filename << std::endl;
+    // Overwrite the file with the sorted list. The map already holds every
+    // entry, so there is nothing to reload.
+    if (!write_instruments(sorted_instruments)) {
         return;
     }
-    
-    outfile << "; Instrument configuration for vgm_ws_to_mid" << std::endl;
-    outfile << "; This file is auto-generated and managed by the converter." << std::endl;
-    outfile << "; You can manually edit the 'midi_instrument' for any entry." << std::endl;
-    outfile << std::endl;
-
-    for (const auto& info : sorted_instruments) {
-        outfile << "[" << info.name << "]" << std::endl;
-        outfile << "fingerprint = " << info.fingerprint << std::endl;
-        outfile << "midi_instrument = " << info.midi_instrument << std::endl;
-        outfile << "source = " << info.source << std::endl;
-        outfile << "registered_at = " << info.registered_at << std::endl;
-        outfile << "graph =" << info.graph;
-        outfile << std::endl;
-    }
-    
-    // Reload the in-memory map to reflect the sorted state
-    load();
+    dirty = false;
 }
 
 int InstrumentConfig::find_or_create_instrument(const std::array<uint8_t, 32>& waveform_data, const std::string& source_filename) {
-    std::string fp = generate_fingerprint(waveform_data);
+    return find_or_create_instrument(WaveFingerprint::from_samples(waveform_data), source_filename);
+}
 
-    auto it = instruments.find(fp);
-    if (it != instruments.end()) {
-        return it->second.midi_instrument;
+int InstrumentConfig::find_or_create_instrument(const WaveFingerprint& fp, const std::string& source_filename) {
+    int known_instrument;
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        if (find_known_unlocked(fp, source_filename, known_instrument)) {
+            return known_instrument;
+        }
     }
 
-    // The slow similarity check has been removed to optimize performance.
-    // We now rely only on exact fingerprint matching.
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    // Another conversion may have registered the same waveform in the meantime.
+    if (find_known_unlocked(fp, source_filename, known_instrument)) {
+        return known_instrument;
+    }
 
+    WaveFingerprint match;
+    bool found = find_similar_unlocked(fp, match);
+    if (deferred) {
+        // Resolve as if this were the first file of the batch; end_deferred()
+        // settles the waveform once the files before this one are registered.
+        DeferredWaveforms& pending = deferred_sources[source_filename];
+        int instrument = found ? find_midi_instrument_unlocked(match) : analyze_waveform(fp.to_samples());
+        pending.order.push_back(fp);
+        pending.instruments.emplace(fp, instrument);
+        return instrument;
+    }
+    if (found) {
+        similar_waveforms.emplace(fp, match);
+        return find_midi_instrument_unlocked(match);
+    }
+
+    std::array<uint8_t, 32> waveform_data = fp.to_samples();
     InstrumentInfo new_info;
     new_info.fingerprint = fp;
     new_info.name = "CustomWave_" + std::to_string(next_custom_wave_id++);
@@ -255,20 +381,83 @@ int InstrumentConfig::find_or_create_instrument(const std::array<uint8_t, 32>& w
     new_info.registered_at = get_current_timestamp();
 
     instruments[fp] = new_info;
-    
+    if (waveform_index_built) add_to_waveform_index_unlocked(fp, new_info.name);
+    dirty = true; // Persisted by flush(), not on every discovery
+    lock.unlock();
+
+    // Report outside the lock: the logger calls back into get_instrument_by_fingerprint().
     usage_logger.report_new_instrument(new_info);
-    save();
 
     return new_info.midi_instrument;
 }
 
-std::string InstrumentConfig::generate_fingerprint(const std::array<uint8_t, 32>& waveform_data) {
-    std::stringstream ss;
-    ss << std::hex << std::setfill('0');
-    for (uint8_t byte : waveform_data) {
-        ss << std::setw(2) << static_cast<int>(byte);
+bool InstrumentConfig::find_known_unlocked(const WaveFingerprint& fp, const std::string& source_filename, int& midi_instrument) const {
+    auto it = instruments.find(fp);
+    if (it != instruments.end()) {
+        midi_instrument = it->second.midi_instrument;
+        return true;
     }
-    return ss.str();
+    if (cache.find_midi_instrument(fp, midi_instrument)) {
+        return true;
+    }
+    auto similar = similar_waveforms.find(fp);
+    if (similar != similar_waveforms.end()) {
+        midi_instrument = find_midi_instrument_unlocked(similar->second);
+        return true;
+    }
+    if (deferred) {
+        auto pending = deferred_sources.find(source_filename);
+        if (pending != deferred_sources.end()) {
+            auto instrument = pending->second.instruments.find(fp);
+            if (instrument != pending->second.instruments.end()) {
+                midi_instrument = instrument->second;
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+bool InstrumentConfig::find_similar_unlocked(const WaveFingerprint& fp, WaveFingerprint& match) {
+    if (match_threshold <= 0) return false;
+    if (!waveform_index_built) build_waveform_index_unlocked();
+    // A rotated or offset copy of a known waveform sounds the same, so
+    // it is preferred over the nearest waveform by sample distance.
+    auto same_shape = canonical_waveforms.find(fp.canonical());
+    if (same_shape != canonical_waveforms.end()) {
+        match = same_shape->second;
+        return true;
+    }
+    return waveform_index.find_nearest(fp, match_threshold, match);
+}
+
+void InstrumentConfig::begin_deferred() {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    deferred = true;
+}
+
+std::vector<std::string> InstrumentConfig::end_deferred(const std::vector<std::string>& source_order) {
+    std::unordered_map<std::string, DeferredWaveforms> pending;
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        deferred = false;
+        pending.swap(deferred_sources);
+    }
+
+    // Register in the order a sequential run would have met the waveforms.
+    std::vector<std::string> changed_sources;
+    for (const auto& source : source_order) {
+        auto it = pending.find(source);
+        if (it == pending.end()) continue;
+        bool changed = false;
+        for (const auto& fp : it->second.order) {
+            if (find_or_create_instrument(fp, source) != it->second.instruments[fp]) {
+                changed = true;
+            }
+        }
+        if (changed) changed_sources.push_back(source);
+    }
+    return changed_sources;
 }
 
 std::string InstrumentConfig::generate_waveform_graph(const std::array<uint8_t, 32>& waveform_data) {
@@ -309,20 +498,63 @@ int InstrumentConfig::analyze_waveform(const std::array<uint8_t, 32>& waveform)
     return 80;
 }
 
-bool InstrumentConfig::are_waveforms_similar(const std::array<uint8_t, 32>& wave1, const std::array<uint8_t, 32>& wave2, int threshold) {
-    int different_samples = 0;
-    for (size_t i = 0; i < 32; ++i) {
-        if (wave1[i] != wave2[i]) {
-            different_samples++;
+InstrumentInfo InstrumentConfig::get_instrument_by_fingerprint(const std::string& fingerprint) const {
+    WaveFingerprint fp;
+    if (!WaveFingerprint::from_hex(fingerprint, fp)) {
+        return InstrumentInfo{}; // e.g. "PCM_SOUND", which has no wavetable
+    }
+    return get_instrument_by_fingerprint(fp);
+}
+
+void InstrumentConfig::set_match_threshold(int threshold) {
+    std::unique_lock<std::shared_mutex> lock(mutex);
+    match_threshold = std::max(0, std::min(threshold, WaveformIndex::MAX_DISTANCE));
+    similar_waveforms.clear();
+}
+
+void InstrumentConfig::build_waveform_index_unlocked() {
+    waveform_index.clear();
+    canonical_waveforms.clear();
+    for (const auto& pair : instruments) {
+        add_to_waveform_index_unlocked(pair.first, pair.second.name);
+    }
+    if (cache.is_open()) {
+        for (const auto& info : cache.read_all()) {
+            add_to_waveform_index_unlocked(info.fingerprint, info.name);
         }
     }
-    return different_samples <= threshold;
+    waveform_index_built = true;
 }
 
-InstrumentInfo InstrumentConfig::get_instrument_by_fingerprint(const std::string& fingerprint) const {
+void InstrumentConfig::add_to_waveform_index_unlocked(const WaveFingerprint& fingerprint, const std::string& name) {
+    waveform_index.add(fingerprint, name);
+    auto inserted = canonical_waveforms.emplace(fingerprint.canonical(), fingerprint);
+    if (!inserted.second && fingerprint < inserted.first->second) {
+        inserted.first->second = fingerprint;
+    }
+}
+
+int InstrumentConfig::find_midi_instrument_unlocked(const WaveFingerprint& fingerprint) const {
+    auto it = instruments.find(fingerprint);
+    if (it != instruments.end()) {
+        return it->second.midi_instrument;
+    }
+    int cached_instrument = -1;
+    cache.find_midi_instrument(fingerprint, cached_instrument);
+    return cached_instrument;
+}
+
+InstrumentInfo InstrumentConfig::get_instrument_by_fingerprint(const WaveFingerprint& query) const {
+    std::shared_lock<std::shared_mutex> lock(mutex);
+    auto similar = similar_waveforms.find(query);
+    const WaveFingerprint& fingerprint = similar != similar_waveforms.end() ? similar->second : query;
     auto it = instruments.find(fingerprint);
     if (it != instruments.end()) {
         return it->second;
     }
+    InstrumentInfo cached_info;
+    if (cache.find_instrument(fingerprint, cached_info)) {
+        return cached_info;
+    }
     return InstrumentInfo{}; // Return an empty info if not found
 }
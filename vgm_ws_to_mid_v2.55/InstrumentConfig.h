@@ -6,38 +6,96 @@
 #include <unordered_map>
 #include <array>
 #include <cstdint>
+#include <shared_mutex>
+#include "WaveFingerprint.h"
+#include "InstrumentCache.h"
+#include "WaveformIndex.h"
 
 // Represents a single instrument's configuration
 struct InstrumentInfo {
     std::string name;
-    std::string fingerprint;
+    WaveFingerprint fingerprint;
     std::string graph;
     int midi_instrument;
     std::string source;
     std::string registered_at;
 };
 
+// Shared by every conversion in a batch. Lookups and registrations are
+// thread-safe; load() and sort_and_save() must not run concurrently with them.
+// Newly discovered waveforms are only kept in memory until flush() is called.
+// Startup reads a compiled cache (<ini>.cache) when it matches the .ini;
+// in that case `instruments` only holds entries added since then.
 class InstrumentConfig {
 public:
     InstrumentConfig(const std::string& filename, class UsageLogger& logger);
+    ~InstrumentConfig();
     void load();
     void save();
+    // Writes instruments.ini if anything was registered since the last write.
+    void flush();
     void sort_and_save();
     int find_or_create_instrument(const std::array<uint8_t, 32>& waveform_data, const std::string& source_filename);
+    int find_or_create_instrument(const WaveFingerprint& fingerprint, const std::string& source_filename);
+    InstrumentInfo get_instrument_by_fingerprint(const WaveFingerprint& fingerprint) const;
     InstrumentInfo get_instrument_by_fingerprint(const std::string& fingerprint) const;
+    // A waveform without an exact match first reuses a known instrument that
+    // is a rotation or DC offset of it (see WaveFingerprint::canonical()),
+    // then the closest known instrument if at most `threshold` samples differ
+    // (at most WaveformIndex::MAX_DISTANCE). 0 turns both off and keeps exact
+    // matching only. Such waveforms are not added to the .ini.
+    void set_match_threshold(int threshold);
+
+    // Parallel batches: after begin_deferred(), a waveform without an exact
+    // match is not registered. It resolves against the instruments known
+    // before the batch and is remembered for its source file. end_deferred()
+    // then registers the remembered waveforms file by file in `source_order`,
+    // as a sequential run would, so names do not depend on thread timing.
+    // It returns the files that were converted with a different instrument
+    // than the one they now resolve to; they need to be converted again.
+    void begin_deferred();
+    std::vector<std::string> end_deferred(const std::vector<std::string>& source_order);
 
 private:
+    // Waveforms one source file met while deferred, in first-use order,
+    // with the instrument its conversion used for each.
+    struct DeferredWaveforms {
+        std::vector<WaveFingerprint> order;
+        std::unordered_map<WaveFingerprint, int, WaveFingerprintHash> instruments;
+    };
+
     void populate_with_defaults();
+    void save_unlocked();
+    void materialize_cache_unlocked();
+    void write_cache_unlocked(const std::vector<InstrumentInfo>& all_instruments);
+    void build_waveform_index_unlocked();
+    void add_to_waveform_index_unlocked(const WaveFingerprint& fingerprint, const std::string& name);
+    int find_midi_instrument_unlocked(const WaveFingerprint& fingerprint) const;
+    bool find_known_unlocked(const WaveFingerprint& fp, const std::string& source_filename, int& midi_instrument) const;
+    bool find_similar_unlocked(const WaveFingerprint& fp, WaveFingerprint& match);
+    bool write_instruments(const std::vector<InstrumentInfo>& ordered_instruments);
     std::string get_current_timestamp();
-    std::string generate_fingerprint(const std::array<uint8_t, 32>& waveform_data);
     std::string generate_waveform_graph(const std::array<uint8_t, 32>& waveform_data);
     int analyze_waveform(const std::array<uint8_t, 32>& waveform_data);
-    bool are_waveforms_similar(const std::array<uint8_t, 32>& wave1, const std::array<uint8_t, 32>& wave2, int threshold);
 
     std::string config_filename;
-    std::unordered_map<std::string, InstrumentInfo> instruments;
+    std::string cache_filename;
+    std::unordered_map<WaveFingerprint, InstrumentInfo, WaveFingerprintHash> instruments;
+    InstrumentCache cache;
     int next_custom_wave_id = 1;
+    bool dirty = false;
+    int match_threshold = WaveformIndex::MAX_DISTANCE;
+    // Built on the first waveform without an exact match, together with
+    // canonical form -> known waveform (the smallest, if several share it).
+    WaveformIndex waveform_index;
+    std::unordered_map<WaveFingerprint, WaveFingerprint, WaveFingerprintHash> canonical_waveforms;
+    bool waveform_index_built = false;
+    // Waveforms resolved by shape or similarity -> the known waveform they matched.
+    std::unordered_map<WaveFingerprint, WaveFingerprint, WaveFingerprintHash> similar_waveforms;
+    bool deferred = false;
+    std::unordered_map<std::string, DeferredWaveforms> deferred_sources;
     UsageLogger& usage_logger;
+    mutable std::shared_mutex mutex;
 };
 
 #endif // INSTRUMENT_CONFIG_H
@@ -0,0 +1,47 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+// Non-owning, read-only view over a contiguous byte range (a minimal
+// stand-in for C++20's std::span<const uint8_t>).
+struct ByteView {
+    const uint8_t* ptr = nullptr;
+    size_t length = 0;
+
+    const uint8_t& operator[](size_t index) const { return ptr[index]; }
+    const uint8_t* data() const { return ptr; }
+    size_t size() const { return length; }
+    bool empty() const { return length == 0; }
+    const uint8_t* begin() const { return ptr; }
+    const uint8_t* end() const { return ptr + length; }
+};
+
+// Maps a whole file read-only into memory. The view stays valid until the
+// object is destroyed or close() is called.
+class MappedFile {
+public:
+    MappedFile() = default;
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    // Returns false if the file cannot be mapped (missing, empty, or the
+    // platform refuses); callers are expected to fall back to a buffered read.
+    bool open(const std::string& filename);
+    void close();
+
+    bool is_open() const { return view_data.ptr != nullptr; }
+    ByteView view() const { return view_data; }
+
+private:
+    ByteView view_data;
+#ifdef _WIN32
+    void* file_handle = nullptr;
+    void* mapping_handle = nullptr;
+#endif
+};
+
+#endif // MAPPED_FILE_H
@@ -0,0 +1,22 @@
+#ifndef MIDI_EVENT_SINK_H
+#define MIDI_EVENT_SINK_H
+
+#include <cstddef>
+#include <cstdint>
+
+struct MidiEvent;
+
+// Receives events as a MidiTrack generates them. A track with a sink
+// forwards its events instead of storing them, so memory use does not grow
+// with the length of the song.
+class MidiEventSink {
+public:
+    virtual ~MidiEventSink() = default;
+
+    // `payload` holds the `payload_length` bytes that follow the status byte
+    // of a meta/SysEx event, and is null for channel messages.
+    virtual void write_event(size_t track_index, const MidiEvent& event,
+                             const uint8_t* payload, size_t payload_length) = 0;
+};
+
+#endif // MIDI_EVENT_SINK_H
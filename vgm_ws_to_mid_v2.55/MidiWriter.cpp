@@ -4,23 +4,36 @@
 #include <algorithm>
 #include <iostream>
 #include <map>
+#include <queue>
+#include <functional>
+#include <cstdio>
+#include <cmath>
+#include <filesystem>
 
 // --- Helper Functions for Endian Swapping ---
-void write_be_16(std::ofstream& file, uint16_t val) {
-    uint8_t data[2] = { static_cast<uint8_t>((val >> 8) & 0xFF), static_cast<uint8_t>(val & 0xFF) };
-    file.write(reinterpret_cast<const char*>(data), 2);
+static void append_be_16(std::vector<uint8_t>& buffer, uint16_t val) {
+    buffer.push_back(static_cast<uint8_t>((val >> 8) & 0xFF));
+    buffer.push_back(static_cast<uint8_t>(val & 0xFF));
 }
 
-void write_be_32(std::ofstream& file, uint32_t val) {
-    uint8_t data[4] = { static_cast<uint8_t>((val >> 24) & 0xFF), static_cast<uint8_t>((val >> 16) & 0xFF), static_cast<uint8_t>((val >> 8) & 0xFF), static_cast<uint8_t>(val & 0xFF) };
-    file.write(reinterpret_cast<const char*>(data), 4);
+static void append_be_32(std::vector<uint8_t>& buffer, uint32_t val) {
+    buffer.push_back(static_cast<uint8_t>((val >> 24) & 0xFF));
+    buffer.push_back(static_cast<uint8_t>((val >> 16) & 0xFF));
+    buffer.push_back(static_cast<uint8_t>((val >> 8) & 0xFF));
+    buffer.push_back(static_cast<uint8_t>(val & 0xFF));
+}
+
+static size_t variable_length_size(uint64_t value) {
+    size_t count = 1;
+    while (value >>= 7) count++;
+    return count;
 }
 
 // --- MidiTrack Class Implementation ---
 
 MidiTrack::MidiTrack() : current_time(0), last_status_byte(0) {}
 
-void MidiTrack::write_variable_length(std::vector<uint8_t>& buffer, uint32_t value) const {
+void MidiTrack::write_variable_length(std::vector<uint8_t>& buffer, uint32_t value) {
     if (value == 0) {
         buffer.push_back(0x00);
         return;
@@ -40,53 +53,92 @@ void MidiTrack::write_variable_length(std::vector<uint8_t>& buffer, uint32_t val
     }
 }
 
-void MidiTrack::add_event(uint32_t delta_time, const std::vector<uint8_t>& event_data) {
-    if (event_data.empty()) return;
+void MidiTrack::set_sink(MidiEventSink* new_sink, size_t track_index) {
+    sink = new_sink;
+    sink_track_index = track_index;
+}
+
+void MidiTrack::append(const MidiEvent& event) {
+    if (sink != nullptr) {
+        sink->write_event(sink_track_index, event, nullptr, 0);
+        return;
+    }
+    if (!events.empty() && event.absolute_time < events.back().absolute_time) {
+        events_sorted = false;
+    }
+    events.push_back(event);
+}
+
+void MidiTrack::add_channel_event(uint64_t delta_time, uint8_t status, uint8_t data1, uint8_t data2) {
     current_time += delta_time;
-    events.push_back({current_time, event_data});
+    append({current_time, status, data1, data2, 0});
 }
 
-void MidiTrack::add_note_on(uint32_t delta_time, uint8_t channel, uint8_t note, uint8_t velocity) {
+uint32_t MidiTrack::store_payload(const uint8_t* payload, size_t length) {
+    payloads.push_back({static_cast<uint32_t>(payload_arena.size()), static_cast<uint32_t>(length)});
+    payload_arena.insert(payload_arena.end(), payload, payload + length);
+    return static_cast<uint32_t>(payloads.size() - 1);
+}
+
+void MidiTrack::add_payload_event(uint64_t delta_time, uint8_t status, const uint8_t* payload, size_t length) {
+    current_time += delta_time;
+    if (sink != nullptr) {
+        sink->write_event(sink_track_index, MidiEvent{current_time, status, 0, 0, 0}, payload, length);
+        return;
+    }
+    append({current_time, status, 0, 0, store_payload(payload, length)});
+}
+
+void MidiTrack::add_event(uint64_t delta_time, const std::vector<uint8_t>& event_data) {
+    if (event_data.empty()) return;
+    uint8_t status = event_data[0];
+    if (status >= 0xF0) {
+        add_payload_event(delta_time, status, event_data.data() + 1, event_data.size() - 1);
+    } else {
+        add_channel_event(delta_time, status,
+                          event_data.size() > 1 ? event_data[1] : 0,
+                          event_data.size() > 2 ? event_data[2] : 0);
+    }
+}
+
+void MidiTrack::add_note_on(uint64_t delta_time, uint8_t channel, uint8_t note, uint8_t velocity) {
     if (channel > 15 || note > 127 || velocity > 127) return;
-    add_event(delta_time, {static_cast<uint8_t>(0x90 | channel), note, velocity});
+    add_channel_event(delta_time, static_cast<uint8_t>(0x90 | channel), note, velocity);
 }
 
-void MidiTrack::add_note_off(uint32_t delta_time, uint8_t channel, uint8_t note) {
+void MidiTrack::add_note_off(uint64_t delta_time, uint8_t channel, uint8_t note) {
     if (channel > 15 || note > 127) return;
-    add_event(delta_time, {static_cast<uint8_t>(0x90 | channel), note, (uint8_t)0});
+    add_channel_event(delta_time, static_cast<uint8_t>(0x90 | channel), note, 0);
 }
 
-void MidiTrack::add_program_change(uint32_t delta_time, uint8_t channel, uint8_t program) {
+void MidiTrack::add_program_change(uint64_t delta_time, uint8_t channel, uint8_t program) {
     if (channel > 15 || program > 127) return;
-    add_event(delta_time, {static_cast<uint8_t>(0xC0 | channel), program});
+    add_channel_event(delta_time, static_cast<uint8_t>(0xC0 | channel), program, 0);
 }
 
-void MidiTrack::add_control_change(uint32_t delta_time, uint8_t channel, uint8_t controller, uint8_t value) {
+void MidiTrack::add_control_change(uint64_t delta_time, uint8_t channel, uint8_t controller, uint8_t value) {
     if (channel > 15 || controller > 127 || value > 127) return;
-    add_event(delta_time, {static_cast<uint8_t>(0xB0 | channel), controller, value});
+    add_channel_event(delta_time, static_cast<uint8_t>(0xB0 | channel), controller, value);
 }
 
-void MidiTrack::add_pitch_bend(uint32_t delta_time, uint8_t channel, uint16_t value) {
+void MidiTrack::add_pitch_bend(uint64_t delta_time, uint8_t channel, uint16_t value) {
     if (channel > 15 || value > 16383) return;
     uint8_t lsb = value & 0x7F;
     uint8_t msb = (value >> 7) & 0x7F;
-    add_event(delta_time, {static_cast<uint8_t>(0xE0 | channel), lsb, msb});
+    add_channel_event(delta_time, static_cast<uint8_t>(0xE0 | channel), lsb, msb);
 }
 
-void MidiTrack::add_meta_event(uint32_t delta_time, uint8_t type, const std::vector<uint8_t>& data) {
-    std::vector<uint8_t> event_data;
-    event_data.push_back(0xFF);
-    event_data.push_back(type);
-    
-    std::vector<uint8_t> len_bytes;
-    write_variable_length(len_bytes, data.size());
-    event_data.insert(event_data.end(), len_bytes.begin(), len_bytes.end());
-    event_data.insert(event_data.end(), data.begin(), data.end());
-    
-    add_event(delta_time, event_data);
+void MidiTrack::add_meta_event(uint64_t delta_time, uint8_t type, const std::vector<uint8_t>& data) {
+    // Arena layout for a meta event: type, variable-length size, data.
+    std::vector<uint8_t> payload;
+    payload.push_back(type);
+    write_variable_length(payload, data.size());
+    payload.insert(payload.end(), data.begin(), data.end());
+
+    add_payload_event(delta_time, 0xFF, payload.data(), payload.size());
 }
 
-void MidiTrack::add_tempo_change(uint32_t delta_time, uint32_t tempo) {
+void MidiTrack::add_tempo_change(uint64_t delta_time, uint32_t tempo) {
     std::vector<uint8_t> tempo_data = {
         static_cast<uint8_t>((tempo >> 16) & 0xFF),
         static_cast<uint8_t>((tempo >> 8) & 0xFF),
@@ -95,11 +147,21 @@ void MidiTrack::add_tempo_change(uint32_t delta_time, uint32_t tempo) {
     add_meta_event(delta_time, 0x51, tempo_data);
 }
 
-uint32_t MidiTrack::get_current_time() const {
+void MidiTrack::repeat_events(size_t first, size_t last, const std::vector<uint64_t>& times) {
+    for (size_t i = first; i < last; ++i) {
+        // Copy by value: appending may reallocate `events`.
+        MidiEvent event = events[i];
+        current_time = times[i - first];
+        event.absolute_time = current_time;
+        append(event); // Payload events can share the original's arena bytes
+    }
+}
+
+uint64_t MidiTrack::get_current_time() const {
     return current_time;
 }
 
-void MidiTrack::copy_events_from(const MidiTrack& source_track, uint32_t start_time, uint32_t end_time) {
+void MidiTrack::copy_events_from(const MidiTrack& source_track, uint64_t start_time, uint64_t end_time) {
     if (end_time <= start_time) return;
 
     // Step 1: Collect all events to be copied into a temporary vector to avoid iterator invalidation.
@@ -114,17 +176,15 @@ void MidiTrack::copy_events_from(const MidiTrack& source_track, uint32_t start_t
         return;
     }
 
-    uint32_t loop_duration = end_time - start_time;
-    uint32_t time_offset = this->current_time - start_time;
+    uint64_t loop_duration = end_time - start_time;
+    uint64_t time_offset = this->current_time - start_time;
 
     // channel -> note -> is_open
     std::map<uint8_t, std::map<uint8_t, bool>> open_notes;
 
     // Step 2: Process the collected events, filter them, and add them to the main event list.
     for (const auto& event : events_to_copy) {
-        if (event.event_data.empty()) continue;
-
-        uint8_t status_byte = event.event_data[0];
+        uint8_t status_byte = event.status;
         uint8_t status_type = status_byte & 0xF0;
 
         // --- Event Filtering Logic ---
@@ -138,42 +198,50 @@ void MidiTrack::copy_events_from(const MidiTrack& source_track, uint32_t start_t
         }
         // 3. Exclude specific Control Changes (CC7 - Main Volume, CC10 - Pan)
         if (status_type == 0xB0) {
-            if (event.event_data.size() > 1) {
-                uint8_t controller = event.event_data[1];
-                if (controller == 7 || controller == 10) {
-                    continue;
-                }
+            uint8_t controller = event.data1;
+            if (controller == 7 || controller == 10) {
+                continue;
             }
         }
         // --- End of Filtering ---
 
         MidiEvent new_event = event;
         new_event.absolute_time += time_offset;
-        this->events.push_back(new_event);
+        if (event.has_payload()) {
+            // SysEx data lives in the source track's arena.
+            const uint8_t* payload = source_track.payload_data(event);
+            size_t length = source_track.payload_length(event);
+            if (sink != nullptr) {
+                sink->write_event(sink_track_index, new_event, payload, length);
+                continue;
+            }
+            new_event.payload_index = store_payload(payload, length);
+            append(new_event);
+            continue;
+        }
+        append(new_event);
 
         // Track open notes within the loop block
-        if (event.event_data.size() > 1) {
-            uint8_t status = event.event_data[0] & 0xF0;
-            uint8_t channel = event.event_data[0] & 0x0F;
-            uint8_t note = event.event_data[1];
-            uint8_t velocity = (event.event_data.size() > 2) ? event.event_data[2] : 0;
-
-            if (status == 0x90 && velocity > 0) {
-                open_notes[channel][note] = true;
-            } else if (status == 0x80 || (status == 0x90 && velocity == 0)) {
-                open_notes[channel].erase(note);
-            }
+        uint8_t status = event.status & 0xF0;
+        uint8_t channel = event.status & 0x0F;
+        uint8_t note = event.data1;
+        uint8_t velocity = (event.data_length() > 1) ? event.data2 : 0;
+
+        if (status == 0x90 && velocity > 0) {
+            open_notes[channel][note] = true;
+        } else if (status == 0x80 || (status == 0x90 && velocity == 0)) {
+            open_notes[channel].erase(note);
         }
     }
 
     // Step 3: Close any notes that were opened within the loop block but not closed by its end.
     // The Note Off event should be at the very end of the copied block.
-    uint32_t loop_end_time = this->current_time + loop_duration;
+    uint64_t loop_end_time = this->current_time + loop_duration;
     for (auto const& [channel, notes] : open_notes) {
         for (auto const& [note, is_open] : notes) {
             if (is_open) {
-                std::vector<uint8_t> note_off_data = {static_cast<uint8_t>(0x80 | channel), note, (uint8_t)0};
-                this->events.push_back({loop_end_time, note_off_data});
+                // Note On with velocity 0, like add_note_off(), so running status is not broken.
+                append({loop_end_time, static_cast<uint8_t>(0x90 | channel), note, 0, 0});
             }
         }
     }
@@ -182,47 +250,365 @@ void MidiTrack::copy_events_from(const MidiTrack& source_track, uint32_t start_t
 }
 
 
-std::vector<uint8_t> MidiTrack::get_track_data() const {
-    std::vector<uint8_t> track_data_bytes;
-    uint32_t last_time = 0;
-    uint8_t running_status = 0;
+static bool is_optimizable_controller(uint8_t controller) {
+    if (controller == 6 || controller == 38) return false;          // Data entry
+    if (controller >= 96 && controller <= 101) return false;        // Data increment/decrement, NRPN, RPN
+    return controller < 120;                                        // Channel mode messages
+}
 
-    // Sort events by absolute time just in case
-    std::vector<MidiEvent> sorted_events = events;
-    std::sort(sorted_events.begin(), sorted_events.end(), [](const MidiEvent& a, const MidiEvent& b) {
-        return a.absolute_time < b.absolute_time;
-    });
+void MidiTrack::sort_events() {
+    if (events_sorted) return;
+    std::vector<MidiEvent> ordered;
+    ordered.reserve(events.size());
+    for_each_in_time_order([&](const MidiEvent& event) { ordered.push_back(event); });
+    events.swap(ordered);
+    events_sorted = true;
+}
+
+void MidiTrack::remove_events(const std::vector<bool>& removed) {
+    size_t out = 0;
+    for (size_t i = 0; i < events.size(); ++i) {
+        if (!removed[i]) events[out++] = events[i];
+    }
+    events.resize(out);
+}
+
+size_t MidiTrack::optimize() {
+    sort_events();
+
+    // Per-channel state as a player would see it; -1 means unknown.
+    int cc_value[16][128];
+    int bend_value[16];
+    // Earlier event in the current tick that a later one may still replace,
+    // and the value that was in effect before it.
+    int cc_pending[16][128];
+    int cc_value_before[16][128];
+    int bend_pending[16];
+    int bend_value_before[16];
+    auto forget_pending = [&](int channel) {
+        std::fill(std::begin(cc_pending[channel]), std::end(cc_pending[channel]), -1);
+        bend_pending[channel] = -1;
+    };
+    auto reset_all = [&]() {
+        for (int ch = 0; ch < 16; ++ch) {
+            std::fill(std::begin(cc_value[ch]), std::end(cc_value[ch]), -1);
+            bend_value[ch] = -1;
+            forget_pending(ch);
+        }
+    };
+    reset_all();
 
-    for (const auto& event : sorted_events) {
-        if (event.event_data.empty()) {
+    std::vector<bool> removed(events.size(), false);
+    uint64_t tick = 0;
+    size_t removed_count = 0;
+
+    for (size_t i = 0; i < events.size(); ++i) {
+        MidiEvent& event = events[i];
+        if (event.absolute_time != tick) {
+            tick = event.absolute_time;
+            for (int ch = 0; ch < 16; ++ch) forget_pending(ch);
+        }
+        if (event.status == 0xF0 || event.status == 0xF7) {
+            reset_all(); // A SysEx message may reset the device
             continue;
         }
-        uint32_t delta_time = event.absolute_time - last_time;
-        write_variable_length(track_data_bytes, delta_time);
+        if (event.has_payload()) continue; // Meta events do not touch channel state
 
-        uint8_t status_byte = event.event_data[0];
-        
-        bool is_meta_or_sysex = (status_byte & 0xF0) == 0xF0;
+        int channel = event.status & 0x0F;
+        uint8_t type = event.status & 0xF0;
 
-        if (is_meta_or_sysex) {
-            track_data_bytes.insert(track_data_bytes.end(), event.event_data.begin(), event.event_data.end());
-            running_status = 0; // Reset running status
+        if (type == 0x80 && event.data2 == 0) {
+            event.status = static_cast<uint8_t>(0x90 | channel);
+            type = 0x90;
+        }
+
+        if (type == 0xB0 && is_optimizable_controller(event.data1)) {
+            int controller = event.data1;
+            int& pending = cc_pending[channel][controller];
+            if (pending >= 0) {
+                removed[pending] = true;
+                removed_count++;
+                cc_value[channel][controller] = cc_value_before[channel][controller];
+                pending = -1;
+            }
+            if (cc_value[channel][controller] == event.data2) {
+                removed[i] = true;
+                removed_count++;
+                continue;
+            }
+            pending = static_cast<int>(i);
+            cc_value_before[channel][controller] = cc_value[channel][controller];
+            cc_value[channel][controller] = event.data2;
+        } else if (type == 0xE0) {
+            int value = event.data1 | (event.data2 << 7);
+            if (bend_pending[channel] >= 0) {
+                removed[bend_pending[channel]] = true;
+                removed_count++;
+                bend_value[channel] = bend_value_before[channel];
+                bend_pending[channel] = -1;
+            }
+            if (bend_value[channel] == value) {
+                removed[i] = true;
+                removed_count++;
+                continue;
+            }
+            bend_pending[channel] = static_cast<int>(i);
+            bend_value_before[channel] = bend_value[channel];
+            bend_value[channel] = value;
+        } else if (type == 0xB0) {
+            if (event.data1 == 121) { // Reset All Controllers
+                std::fill(std::begin(cc_value[channel]), std::end(cc_value[channel]), -1);
+                bend_value[channel] = -1;
+            }
+            forget_pending(channel);
         } else {
-            if (status_byte != running_status) {
-                track_data_bytes.push_back(status_byte);
-                running_status = status_byte;
+            // Notes and program changes sound with the values set so far.
+            forget_pending(channel);
+        }
+    }
+
+    if (removed_count > 0) remove_events(removed);
+    return removed_count;
+}
+
+// Controllers the chip drives as a continuous curve (volume, pan, expression...).
+static bool is_continuous_controller(uint8_t controller) {
+    switch (controller) {
+        case 1: case 2: case 4: case 7: case 10: case 11:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Marks points of one curve for removal. `points` are (tick, value) pairs of
+// consecutive events with strictly increasing ticks; the first and last are
+// always kept.
+static void decimate_curve(const std::vector<std::pair<uint64_t, int>>& points, std::vector<bool>& keep,
+                           uint32_t min_ticks, double min_delta, double rdp_epsilon) {
+    size_t n = points.size();
+    keep.assign(n, true);
+    if (n < 3) return;
+
+    if (rdp_epsilon > 0) {
+        // Ramer-Douglas-Peucker, measuring the value error at each point's tick.
+        std::fill(keep.begin(), keep.end(), false);
+        keep[0] = keep[n - 1] = true;
+        std::vector<std::pair<size_t, size_t>> spans = {{0, n - 1}};
+        while (!spans.empty()) {
+            auto [first, last] = spans.back();
+            spans.pop_back();
+            double x0 = points[first].first, y0 = points[first].second;
+            double slope = (points[last].second - y0) / (static_cast<double>(points[last].first) - x0);
+            double worst = 0;
+            size_t worst_index = 0;
+            for (size_t i = first + 1; i < last; ++i) {
+                double error = std::abs(points[i].second - (y0 + slope * (points[i].first - x0)));
+                if (error > worst) {
+                    worst = error;
+                    worst_index = i;
+                }
+            }
+            if (worst > rdp_epsilon) {
+                keep[worst_index] = true;
+                spans.push_back({first, worst_index});
+                spans.push_back({worst_index, last});
             }
-            track_data_bytes.insert(track_data_bytes.end(), event.event_data.begin() + 1, event.event_data.end());
         }
-        last_time = event.absolute_time;
     }
+
+    if (min_ticks > 0 || min_delta > 0) {
+        size_t last_kept = 0;
+        for (size_t i = 1; i + 1 < n; ++i) {
+            if (!keep[i]) continue;
+            if (points[i].first - points[last_kept].first < min_ticks ||
+                std::abs(points[i].second - points[last_kept].second) < min_delta) {
+                keep[i] = false;
+            } else {
+                last_kept = i;
+            }
+        }
+    }
+}
+
+size_t MidiTrack::decimate(const DecimationSettings& settings) {
+    if (!settings.enabled()) return 0;
+    sort_events();
+
+    double bend_units_per_cent = 8191.0 / (settings.bend_range_semitones * 100.0);
+    std::vector<bool> removed(events.size(), false);
+    size_t removed_count = 0;
+
+    // Open curve per channel: slot 128 is pitch bend, the others are controllers.
+    std::vector<std::vector<size_t>> curves(16 * 129);
+    std::vector<std::pair<uint64_t, int>> points;
+    std::vector<size_t> point_events;
+    std::vector<bool> keep;
+
+    auto close_curve = [&](int channel, int slot) {
+        std::vector<size_t>& curve = curves[channel * 129 + slot];
+        if (curve.size() < 3) {
+            curve.clear();
+            return;
+        }
+        // Within a curve only the last value of a tick is ever heard.
+        points.clear();
+        point_events.clear();
+        for (size_t k = 0; k < curve.size(); ++k) {
+            const MidiEvent& event = events[curve[k]];
+            if (k + 1 < curve.size() && events[curve[k + 1]].absolute_time == event.absolute_time) {
+                removed[curve[k]] = true;
+                removed_count++;
+                continue;
+            }
+            int value = slot == 128 ? (event.data1 | (event.data2 << 7)) : event.data2;
+            points.push_back({event.absolute_time, value});
+            point_events.push_back(curve[k]);
+        }
+        if (slot == 128) {
+            decimate_curve(points, keep, settings.min_ticks, settings.min_cents * bend_units_per_cent,
+                           settings.rdp_cents * bend_units_per_cent);
+        } else {
+            decimate_curve(points, keep, settings.min_ticks, settings.min_cc_delta, 0.0);
+        }
+        for (size_t k = 0; k < keep.size(); ++k) {
+            if (!keep[k]) {
+                removed[point_events[k]] = true;
+                removed_count++;
+            }
+        }
+        curve.clear();
+    };
+    auto close_channel = [&](int channel) {
+        for (int slot = 0; slot < 129; ++slot) close_curve(channel, slot);
+    };
+
+    for (size_t i = 0; i < events.size(); ++i) {
+        const MidiEvent& event = events[i];
+        if (event.status == 0xF0 || event.status == 0xF7) {
+            for (int ch = 0; ch < 16; ++ch) close_channel(ch);
+            continue;
+        }
+        if (event.has_payload()) continue;
+
+        int channel = event.status & 0x0F;
+        uint8_t type = event.status & 0xF0;
+        if (type == 0xE0) {
+            curves[channel * 129 + 128].push_back(i);
+        } else if (type == 0xB0 && is_continuous_controller(event.data1)) {
+            curves[channel * 129 + event.data1].push_back(i);
+        } else {
+            // Notes, program changes and other controllers must see exact values.
+            close_channel(channel);
+        }
+    }
+    for (int ch = 0; ch < 16; ++ch) close_channel(ch);
+
+    if (removed_count > 0) remove_events(removed);
+    return removed_count;
+}
+
+std::vector<uint8_t> MidiTrack::get_track_data() const {
+    std::vector<uint8_t> track_data_bytes;
+    encode(track_data_bytes);
     return track_data_bytes;
 }
 
+std::vector<uint32_t> MidiTrack::time_order() const {
+    // Stable, so events sharing a tick keep the order they were added in.
+    std::vector<uint32_t> order(events.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [this](uint32_t a, uint32_t b) {
+        return events[a].absolute_time < events[b].absolute_time;
+    });
+    return order;
+}
+
+size_t MidiTrack::encoded_size() const {
+    size_t size = 0;
+    uint64_t last_time = 0;
+    uint8_t running_status = 0;
+    for_each_in_time_order([&](const MidiEvent& event) {
+        size += variable_length_size(event.absolute_time - last_time);
+        if (event.has_payload()) {
+            size += 1 + payload_length(event);
+            running_status = 0;
+        } else {
+            if (event.status != running_status) {
+                size++;
+                running_status = event.status;
+            }
+            size += event.data_length();
+        }
+        last_time = event.absolute_time;
+    });
+    size += variable_length_size(current_time - last_time) + 3; // End of Track
+    return size;
+}
+
+bool MidiTrack::encode_event(std::vector<uint8_t>& out, const MidiEvent& event, const uint8_t* payload,
+                             size_t payload_length, uint64_t& last_time, uint8_t& running_status) {
+    uint64_t delta_time = event.absolute_time - last_time;
+    if (delta_time > MAX_DELTA_TIME) return false;
+    write_variable_length(out, static_cast<uint32_t>(delta_time));
+
+    uint8_t status_byte = event.status;
+
+    if (event.has_payload()) {
+        out.push_back(status_byte);
+        out.insert(out.end(), payload, payload + payload_length);
+        running_status = 0; // Reset running status
+    } else {
+        if (status_byte != running_status) {
+            out.push_back(status_byte);
+            running_status = status_byte;
+        }
+        out.push_back(event.data1);
+        if (event.data_length() > 1) {
+            out.push_back(event.data2);
+        }
+    }
+    last_time = event.absolute_time;
+    return true;
+}
+
+MidiTrack::Reader::Reader(const MidiTrack& track) : track(&track), count(track.events.size()) {
+    if (!track.events_sorted) {
+        order = track.time_order();
+    }
+}
+
+bool MidiTrack::encode(std::vector<uint8_t>& out) const {
+    uint64_t last_time = 0;
+    uint8_t running_status = 0;
+    bool valid = true;
+    for_each_in_time_order([&](const MidiEvent& event) {
+        if (event.has_payload()) {
+            valid &= encode_event(out, event, payload_data(event), payload_length(event), last_time, running_status);
+        } else {
+            valid &= encode_event(out, event, nullptr, 0, last_time, running_status);
+        }
+    });
+
+    // End of Track at the track's current time; the track itself is not modified.
+    valid &= current_time - last_time <= MAX_DELTA_TIME;
+    write_variable_length(out, static_cast<uint32_t>(current_time - last_time));
+    out.push_back(0xFF);
+    out.push_back(0x2F);
+    out.push_back(0x00);
+    return valid;
+}
+
 // --- MidiWriter Class Implementation ---
 
 MidiWriter::MidiWriter(uint16_t ticks_per_quarter_note) : ticks_per_quarter_note(ticks_per_quarter_note) {}
 
+bool MidiWriter::set_format(uint16_t new_format) {
+    if (new_format > 1) return false;
+    format = new_format;
+    return true;
+}
+
 MidiTrack& MidiWriter::get_track(size_t index) {
     if (index >= tracks.size()) {
         throw std::out_of_range("Track index is out of range.");
@@ -230,31 +616,155 @@ MidiTrack& MidiWriter::get_track(size_t index) {
     return tracks[index];
 }
 
+const MidiTrack& MidiWriter::get_track(size_t index) const {
+    if (index >= tracks.size()) {
+        throw std::out_of_range("Track index is out of range.");
+    }
+    return tracks[index];
+}
+
 size_t MidiWriter::add_track() {
     tracks.emplace_back();
+    tracks.back().set_sink(sink, tracks.size() - 1);
     return tracks.size() - 1;
 }
 
-bool MidiWriter::write_to_file(const std::string& path) {
-    std::ofstream file(path, std::ios::binary);
-    if (!file) {
-        return false;
+void MidiWriter::set_sink(MidiEventSink* new_sink) {
+    sink = new_sink;
+    for (size_t i = 0; i < tracks.size(); ++i) {
+        tracks[i].set_sink(sink, i);
     }
+}
 
-    file.write("MThd", 4);
-    write_be_32(file, 6);
-    write_be_16(file, 1);
-    write_be_16(file, static_cast<uint16_t>(tracks.size()));
-    write_be_16(file, ticks_per_quarter_note);
+size_t MidiWriter::decimate(const DecimationSettings& settings) {
+    size_t removed = 0;
+    for (auto& track : tracks) {
+        removed += track.decimate(settings);
+    }
+    return removed;
+}
 
+size_t MidiWriter::optimize() {
+    size_t removed = 0;
     for (auto& track : tracks) {
-        track.add_meta_event(0, 0x2F, {}); // End of Track
+        removed += track.optimize();
+    }
+    return removed;
+}
+
+uint64_t MidiWriter::get_end_time() const {
+    uint64_t end_time = 0;
+    for (const auto& track : tracks) {
+        end_time = std::max(end_time, track.get_current_time());
+    }
+    return end_time;
+}
 
-        std::vector<uint8_t> track_data = track.get_track_data();
-        file.write("MTrk", 4);
-        write_be_32(file, static_cast<uint32_t>(track_data.size()));
-        file.write(reinterpret_cast<const char*>(track_data.data()), track_data.size());
+bool MidiWriter::encode_merged_track(std::vector<uint8_t>& out) const {
+    // k-way merge by absolute time; on equal times the lower track index goes
+    // first, so the meta track's tempo precedes channel events at tick 0.
+    std::vector<MidiTrack::Reader> readers;
+    readers.reserve(tracks.size());
+    for (const auto& track : tracks) {
+        readers.emplace_back(track);
+    }
+    using HeapEntry = std::pair<uint64_t, size_t>; // (absolute time, track index)
+    std::priority_queue<HeapEntry, std::vector<HeapEntry>, std::greater<HeapEntry>> heap;
+    for (size_t i = 0; i < readers.size(); ++i) {
+        if (!readers[i].done()) heap.push({readers[i].event().absolute_time, i});
     }
 
-    return file.good();
+    uint64_t last_time = 0;
+    uint8_t running_status = 0;
+    bool valid = true;
+    while (!heap.empty()) {
+        size_t index = heap.top().second;
+        heap.pop();
+        MidiTrack::Reader& reader = readers[index];
+        if (reader.event().has_payload()) {
+            valid &= MidiTrack::encode_event(out, reader.event(), reader.payload(), reader.payload_length(),
+                                             last_time, running_status);
+        } else {
+            valid &= MidiTrack::encode_event(out, reader.event(), nullptr, 0, last_time, running_status);
+        }
+        reader.next();
+        if (!reader.done()) heap.push({reader.event().absolute_time, index});
+    }
+
+    // One End of Track for the merged stream, where the longest track ends.
+    uint64_t end_delta = get_end_time() - last_time;
+    valid &= end_delta <= MidiTrack::MAX_DELTA_TIME;
+    MidiTrack::write_variable_length(out, static_cast<uint32_t>(end_delta));
+    out.push_back(0xFF);
+    out.push_back(0x2F);
+    out.push_back(0x00);
+    return valid;
+}
+
+bool MidiWriter::write_to_file(const std::string& path) const {
+    // Size every chunk first so the whole file is built in one allocation.
+    // For Format 0 this is only an estimate: merging can break running status.
+    std::vector<size_t> track_sizes;
+    size_t total_size = 14;
+    for (const auto& track : tracks) {
+        track_sizes.push_back(track.encoded_size());
+        total_size += 8 + track_sizes.back();
+    }
+
+    std::vector<uint8_t> buffer;
+    buffer.reserve(total_size);
+    buffer.insert(buffer.end(), {'M', 'T', 'h', 'd'});
+    append_be_32(buffer, 6);
+    append_be_16(buffer, format);
+    append_be_16(buffer, format == 0 ? 1 : static_cast<uint16_t>(tracks.size()));
+    append_be_16(buffer, ticks_per_quarter_note);
+
+    bool valid = true;
+    if (format == 0) {
+        buffer.insert(buffer.end(), {'M', 'T', 'r', 'k', 0, 0, 0, 0});
+        size_t body_start = buffer.size();
+        valid = encode_merged_track(buffer);
+        uint32_t body_size = static_cast<uint32_t>(buffer.size() - body_start);
+        for (int i = 0; i < 4; ++i) {
+            buffer[body_start - 4 + i] = static_cast<uint8_t>(body_size >> (24 - 8 * i));
+        }
+    } else {
+        for (size_t i = 0; i < tracks.size(); ++i) {
+            buffer.insert(buffer.end(), {'M', 'T', 'r', 'k'});
+            append_be_32(buffer, static_cast<uint32_t>(track_sizes[i]));
+            valid &= tracks[i].encode(buffer);
+        }
+    }
+    if (!valid) {
+        std::cerr << "Error: A gap between two events is longer than the " << MidiTrack::MAX_DELTA_TIME
+                  << " ticks a MIDI file can express; not writing " << path << std::endl;
+        return false;
+    }
+
+    // Write everything at once to a temporary file and move it into place, so
+    // a failed or interrupted write never leaves a truncated .mid behind.
+    std::string temp_path = path + ".tmp";
+    {
+        std::ofstream file(temp_path, std::ios::binary);
+        if (!file) {
+            std::cerr << "Error: Could not open MIDI file for writing: " << temp_path << std::endl;
+            return false;
+        }
+        file.write(reinterpret_cast<const char*>(buffer.data()), static_cast<std::streamsize>(buffer.size()));
+        file.close();
+        if (file.fail()) {
+            std::cerr << "Error: Failed to write MIDI file: " << temp_path << std::endl;
+            std::remove(temp_path.c_str());
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::rename(temp_path, path, ec);
+    if (ec) {
+        std::cerr << "Error: Could not replace " << path << ": " << ec.message() << std::endl;
+        std::remove(temp_path.c_str());
+        return false;
+    }
+    return true;
 }
@@ -6,56 +6,195 @@
 #include <fstream>
 #include <cstdint>
 #include <numeric>
+#include "MidiEventSink.h"
 
+// Fixed-size (16-byte) event record. Channel messages are stored inline;
+// meta and SysEx events (status >= 0xF0) keep the bytes following the
+// status byte in the owning track's payload arena, found through its
+// payload table.
 struct MidiEvent {
-    uint32_t absolute_time;
-    std::vector<uint8_t> event_data;
+    uint64_t absolute_time;
+    uint8_t status;
+    uint8_t data1;
+    uint8_t data2;
+    uint32_t payload_index; // Only for status >= 0xF0
+
+    bool has_payload() const { return status >= 0xF0; }
+    // Number of data bytes of a channel message (program change and channel pressure take one).
+    size_t data_length() const {
+        uint8_t type = status & 0xF0;
+        return (type == 0xC0 || type == 0xD0) ? 1 : 2;
+    }
+};
+
+// Limits for MidiTrack::decimate(); 0 disables a limit.
+struct DecimationSettings {
+    uint32_t min_ticks = 0;   // Minimum spacing between kept values of one curve
+    double min_cents = 0.0;   // Minimum pitch change between kept pitch bends
+    double rdp_cents = 0.0;   // Ramer-Douglas-Peucker tolerance for pitch bend curves
+    int min_cc_delta = 0;     // Minimum change between kept controller values
+    double bend_range_semitones = 2.0; // Pitch bend range the track sets via RPN 0
+
+    bool enabled() const { return min_ticks > 0 || min_cents > 0 || rdp_cents > 0 || min_cc_delta > 0; }
 };
 
 // Represents a single MIDI track
 class MidiTrack {
 public:
+    // Largest delta time a variable-length quantity may hold in a Standard
+    // MIDI File (four bytes). Event times are 64-bit and never wrap, but a
+    // longer gap between two events of a track cannot be written.
+    static constexpr uint64_t MAX_DELTA_TIME = 0x0FFFFFFF;
+
     MidiTrack();
 
-    void add_event(uint32_t delta_time, const std::vector<uint8_t>& event_data);
-    void add_note_on(uint32_t delta_time, uint8_t channel, uint8_t note, uint8_t velocity);
-    void add_note_off(uint32_t delta_time, uint8_t channel, uint8_t note);
-    void add_program_change(uint32_t delta_time, uint8_t channel, uint8_t program);
-    void add_control_change(uint32_t delta_time, uint8_t channel, uint8_t controller, uint8_t value);
-    void add_pitch_bend(uint32_t delta_time, uint8_t channel, uint16_t value);
-    void add_meta_event(uint32_t delta_time, uint8_t type, const std::vector<uint8_t>& data);
-    void add_tempo_change(uint32_t delta_time, uint32_t tempo);
+    void add_event(uint64_t delta_time, const std::vector<uint8_t>& event_data);
+    void add_note_on(uint64_t delta_time, uint8_t channel, uint8_t note, uint8_t velocity);
+    void add_note_off(uint64_t delta_time, uint8_t channel, uint8_t note);
+    void add_program_change(uint64_t delta_time, uint8_t channel, uint8_t program);
+    void add_control_change(uint64_t delta_time, uint8_t channel, uint8_t controller, uint8_t value);
+    void add_pitch_bend(uint64_t delta_time, uint8_t channel, uint16_t value);
+    void add_meta_event(uint64_t delta_time, uint8_t type, const std::vector<uint8_t>& data);
+    void add_tempo_change(uint64_t delta_time, uint32_t tempo);
     
-    void copy_events_from(const MidiTrack& source_track, uint32_t start_time, uint32_t end_time);
-    uint32_t get_current_time() const;
+    void copy_events_from(const MidiTrack& source_track, uint64_t start_time, uint64_t end_time);
+    // Appends copies of this track's events [first, last) unchanged except
+    // for their times, taken from `times` (one per event, non-decreasing and
+    // not before the current time).
+    void repeat_events(size_t first, size_t last, const std::vector<uint64_t>& times);
+    uint64_t get_current_time() const;
+    // Number of stored events (always 0 while a sink is set).
+    size_t get_event_count() const { return events.size(); }
 
+    // Removes events that cannot change playback and rewrites note-offs as
+    // 0x9n velocity 0 so they share running status with note-ons:
+    //  - a controller or pitch bend overwritten later in the same tick, with
+    //    no note or program change on that channel in between;
+    //  - a controller or pitch bend that repeats the channel's current value.
+    // RPN/NRPN selection and data entry (CC 6, 38, 96-101) and channel mode
+    // messages (CC 120-127) are always kept. Returns the number of events removed.
+    size_t optimize();
+
+    // Thins out pitch bend and continuous controller (CC 1, 2, 4, 7, 10, 11)
+    // curves. A curve is a run of such events on one channel between notes,
+    // program changes or other controllers; its first and last values are
+    // kept, so every note still starts with exact values. Returns the number
+    // of events removed.
+    size_t decimate(const DecimationSettings& settings);
+
+    // Forward events to `sink` (tagged with `track_index`) instead of storing
+    // them; pass nullptr to store them again.
+    void set_sink(MidiEventSink* sink, size_t track_index);
+
+    // Encoded track body (without the MTrk header), terminated by End of Track.
     std::vector<uint8_t> get_track_data() const;
+    // Appends the same bytes as get_track_data() to `out`. Returns false if a
+    // delta time exceeds MAX_DELTA_TIME; the bytes are then not a valid track.
+    bool encode(std::vector<uint8_t>& out) const;
+    // Exact number of bytes encode() appends.
+    size_t encoded_size() const;
+
+    // Walks a track's events in time order (events sharing a tick keep the
+    // order they were added in) without copying them.
+    class Reader {
+    public:
+        explicit Reader(const MidiTrack& track);
+        bool done() const { return position >= count; }
+        const MidiEvent& event() const { return track->events[order.empty() ? position : order[position]]; }
+        const uint8_t* payload() const { return track->payload_data(event()); }
+        size_t payload_length() const { return track->payload_length(event()); }
+        void next() { position++; }
+
+    private:
+        const MidiTrack* track;
+        std::vector<uint32_t> order; // Only filled for tracks that are out of order
+        size_t position = 0;
+        size_t count = 0;
+    };
+
+    // Appends one event with its delta time, omitting the status byte when running
+    // status allows. Returns false if the delta time exceeds MAX_DELTA_TIME.
+    static bool encode_event(std::vector<uint8_t>& out, const MidiEvent& event, const uint8_t* payload,
+                             size_t payload_length, uint64_t& last_time, uint8_t& running_status);
+    static void write_variable_length(std::vector<uint8_t>& buffer, uint32_t value);
 
 private:
-    void write_variable_length(std::vector<uint8_t>& buffer, uint32_t value) const;
+    struct PayloadRange {
+        uint32_t offset;
+        uint32_t length;
+    };
+
+    const uint8_t* payload_data(const MidiEvent& event) const { return payload_arena.data() + payloads[event.payload_index].offset; }
+    size_t payload_length(const MidiEvent& event) const { return payloads[event.payload_index].length; }
+    uint32_t store_payload(const uint8_t* payload, size_t length);
+    void add_channel_event(uint64_t delta_time, uint8_t status, uint8_t data1, uint8_t data2);
+    void add_payload_event(uint64_t delta_time, uint8_t status, const uint8_t* payload, size_t length);
+    void append(const MidiEvent& event);
+    void sort_events();
+    void remove_events(const std::vector<bool>& removed);
+    std::vector<uint32_t> time_order() const;
+    template <typename Visitor>
+    void for_each_in_time_order(Visitor&& visit) const {
+        if (events_sorted) {
+            for (const auto& event : events) visit(event);
+        } else {
+            for (uint32_t index : time_order()) visit(events[index]);
+        }
+    }
 
     std::vector<MidiEvent> events;
-    uint32_t current_time = 0;
+    std::vector<uint8_t> payload_arena;
+    std::vector<PayloadRange> payloads;
+    // Events are appended in time order except by copy_events_from(); only
+    // then does encoding need to (stably) reorder them.
+    bool events_sorted = true;
+    MidiEventSink* sink = nullptr;
+    size_t sink_track_index = 0;
+    uint64_t current_time = 0;
     uint8_t last_status_byte = 0;
 };
 
-// Main class to write a Format 1 MIDI file
+// Main class to write a MIDI file: Format 1 (one chunk per track, the
+// default) or Format 0 (all tracks merged into a single chunk).
 class MidiWriter {
 public:
     MidiWriter(uint16_t ticks_per_quarter_note);
 
+    // 0 or 1; anything else is rejected and leaves the format unchanged.
+    bool set_format(uint16_t format);
+
     // Get a reference to a track to add events to it
     MidiTrack& get_track(size_t index);
+    const MidiTrack& get_track(size_t index) const;
+    size_t get_track_count() const { return tracks.size(); }
 
     // Add a new track, returns the index of the new track
     size_t add_track();
 
-    // Write the final MIDI file to the specified path
-    bool write_to_file(const std::string& path);
+    // Send the events of every track, including tracks added later, to
+    // `sink` as they are generated. The writer then keeps no events itself.
+    void set_sink(MidiEventSink* sink);
+
+    // Latest current time of any track, i.e. where End of Track belongs.
+    uint64_t get_end_time() const;
+
+    // Runs MidiTrack::decimate() on every track; returns the number of events removed.
+    size_t decimate(const DecimationSettings& settings);
+
+    // Runs MidiTrack::optimize() on every track; returns the number of events removed.
+    size_t optimize();
+
+    // Write the final MIDI file to the specified path. The tracks are not
+    // modified, so this may be called more than once.
+    bool write_to_file(const std::string& path) const;
 
 private:
+    bool encode_merged_track(std::vector<uint8_t>& out) const;
+
     uint16_t ticks_per_quarter_note;
+    uint16_t format = 1;
     std::vector<MidiTrack> tracks;
+    MidiEventSink* sink = nullptr;
 };
 
 #endif // MIDI_WRITER_H
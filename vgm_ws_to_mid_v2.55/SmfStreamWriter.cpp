@@ -0,0 +1,161 @@
+#include "SmfStreamWriter.h"
+#include "MidiWriter.h"
+#include <filesystem>
+#include <iostream>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+SmfStreamWriter::~SmfStreamWriter() {
+    close();
+}
+
+bool SmfStreamWriter::open(const std::string& output_path, uint16_t ticks_per_quarter_note) {
+    close();
+    if (output_path == "-") {
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        file = stdout;
+        owns_file = false;
+    } else {
+        path = output_path;
+        temp_path = output_path + ".tmp";
+        file = std::fopen(temp_path.c_str(), "wb");
+        owns_file = true;
+        if (file == nullptr) {
+            std::cerr << "Error: Could not open MIDI stream for writing: " << temp_path << std::endl;
+            return false;
+        }
+    }
+    failed = false;
+    track_length = 0;
+    last_time = 0;
+    running_status = 0;
+
+    const uint8_t header[] = {
+        'M', 'T', 'h', 'd', 0, 0, 0, 6,
+        0, 0,  // Format 0
+        0, 1,  // One track
+        static_cast<uint8_t>(ticks_per_quarter_note >> 8), static_cast<uint8_t>(ticks_per_quarter_note & 0xFF),
+        'M', 'T', 'r', 'k'
+    };
+    put(header, sizeof(header));
+
+    seekable = std::fseek(file, 0, SEEK_CUR) == 0;
+    length_position = seekable ? std::ftell(file) : 0;
+    const uint8_t unknown_length[] = {0xFF, 0xFF, 0xFF, 0xFF};
+    put(unknown_length, sizeof(unknown_length));
+    track_length = 0; // The placeholder is not part of the chunk body
+    return !failed;
+}
+
+void SmfStreamWriter::put(const uint8_t* data, size_t length) {
+    if (file == nullptr || failed) return;
+    if (std::fwrite(data, 1, length, file) != length) {
+        failed = true;
+        std::cerr << "Error: Failed to write MIDI stream." << std::endl;
+    }
+    track_length += length;
+}
+
+void SmfStreamWriter::put_delta_time(uint64_t delta_time) {
+    if (delta_time > MidiTrack::MAX_DELTA_TIME && !failed) {
+        failed = true;
+        std::cerr << "Error: A gap between two events is longer than the " << MidiTrack::MAX_DELTA_TIME
+                  << " ticks a MIDI file can express." << std::endl;
+    }
+    put_variable_length(static_cast<uint32_t>(delta_time));
+}
+
+void SmfStreamWriter::put_variable_length(uint32_t value) {
+    uint8_t bytes[5];
+    int count = 0;
+    do {
+        bytes[count++] = value & 0x7F;
+        value >>= 7;
+    } while (value > 0);
+    for (int i = count - 1; i >= 0; --i) {
+        put_byte(i > 0 ? (bytes[i] | 0x80) : bytes[i]);
+    }
+}
+
+void SmfStreamWriter::write_event(size_t, const MidiEvent& event, const uint8_t* payload, size_t payload_length) {
+    if (file == nullptr) return;
+
+    // Tracks are generated in step with the chip, so times only move forward.
+    uint64_t delta_time = event.absolute_time > last_time ? event.absolute_time - last_time : 0;
+    if (delta_time > 0 && !seekable) {
+        std::fflush(file); // Hand everything up to the previous tick to the reader
+    }
+    put_delta_time(delta_time);
+    last_time += delta_time;
+
+    if (event.has_payload()) {
+        put_byte(event.status);
+        put(payload, payload_length);
+        running_status = 0;
+    } else {
+        if (event.status != running_status) {
+            put_byte(event.status);
+            running_status = event.status;
+        }
+        put_byte(event.data1);
+        if (event.data_length() > 1) {
+            put_byte(event.data2);
+        }
+    }
+}
+
+bool SmfStreamWriter::finish(uint64_t end_time) {
+    if (file == nullptr) return false;
+
+    put_delta_time(end_time > last_time ? end_time - last_time : 0);
+    const uint8_t end_of_track[] = {0xFF, 0x2F, 0x00};
+    put(end_of_track, sizeof(end_of_track));
+
+    if (seekable && !failed) {
+        const uint8_t length[] = {
+            static_cast<uint8_t>(track_length >> 24), static_cast<uint8_t>(track_length >> 16),
+            static_cast<uint8_t>(track_length >> 8), static_cast<uint8_t>(track_length)
+        };
+        if (std::fseek(file, length_position, SEEK_SET) != 0 || std::fwrite(length, 1, 4, file) != 4) {
+            failed = true;
+            std::cerr << "Error: Could not update the MIDI stream's track length." << std::endl;
+        }
+        std::fseek(file, 0, SEEK_END);
+    }
+    if (std::fflush(file) != 0) failed = true;
+    if (owns_file) {
+        if (std::fclose(file) != 0) failed = true;
+        file = nullptr;
+        if (!failed) {
+            std::error_code ec;
+            std::filesystem::rename(temp_path, path, ec);
+            if (ec) {
+                failed = true;
+                std::cerr << "Error: Could not replace " << path << ": " << ec.message() << std::endl;
+            }
+        }
+    }
+
+    bool ok = !failed;
+    close();
+    return ok;
+}
+
+void SmfStreamWriter::close() {
+    if (file != nullptr && owns_file) {
+        std::fclose(file);
+    }
+    // The temporary file only survives a successful finish() under its final name.
+    if (!temp_path.empty()) {
+        std::remove(temp_path.c_str());
+    }
+    file = nullptr;
+    owns_file = false;
+    path.clear();
+    temp_path.clear();
+}
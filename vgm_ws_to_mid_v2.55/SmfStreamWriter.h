@@ -0,0 +1,53 @@
+#ifndef SMF_STREAM_WRITER_H
+#define SMF_STREAM_WRITER_H
+
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include "MidiEventSink.h"
+
+// Writes a Format 0 Standard MIDI File while the conversion runs. Events of
+// all tracks are merged into the single MTrk chunk in the order they are
+// generated, with running status across the merged stream.
+//
+// The path "-" writes to stdout, so the output can be piped into another
+// program. When the destination is seekable the MTrk length is patched in
+// finish(); on a pipe it stays 0xFFFFFFFF ("unknown"), which streaming
+// readers accept. A file is written as "<path>.tmp" and only renamed over
+// `path` by a successful finish(), so a failed conversion leaves an
+// existing file untouched.
+class SmfStreamWriter : public MidiEventSink {
+public:
+    SmfStreamWriter() = default;
+    ~SmfStreamWriter();
+    SmfStreamWriter(const SmfStreamWriter&) = delete;
+    SmfStreamWriter& operator=(const SmfStreamWriter&) = delete;
+
+    bool open(const std::string& output_path, uint16_t ticks_per_quarter_note);
+    void write_event(size_t track_index, const MidiEvent& event,
+                     const uint8_t* payload, size_t payload_length) override;
+    // Writes End of Track at `end_time`, fixes up the chunk length, closes the
+    // output and moves a file into place. Without it the temporary file is removed.
+    bool finish(uint64_t end_time);
+
+private:
+    void put(const uint8_t* data, size_t length);
+    void put_byte(uint8_t value) { put(&value, 1); }
+    // Fails the stream if the delta is too long for a variable-length quantity.
+    void put_delta_time(uint64_t delta_time);
+    void put_variable_length(uint32_t value);
+    void close();
+
+    FILE* file = nullptr;
+    bool owns_file = false;
+    std::string path;      // Final file name; empty for stdout
+    std::string temp_path; // What is actually written until finish()
+    bool seekable = false;
+    bool failed = false;
+    long length_position = 0;
+    uint64_t track_length = 0;
+    uint64_t last_time = 0;
+    uint8_t running_status = 0;
+};
+
+#endif // SMF_STREAM_WRITER_H
@@ -0,0 +1,97 @@
+#include "ThreadPool.h"
+#include <iostream>
+#include <exception>
+
+ThreadPool::ThreadPool(size_t num_threads) {
+    if (num_threads == 0) num_threads = 1;
+    for (size_t i = 0; i < num_threads; ++i) {
+        queues.push_back(std::make_unique<WorkerQueue>());
+    }
+    for (size_t i = 0; i < num_threads; ++i) {
+        workers.emplace_back(&ThreadPool::worker_loop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(state_mutex);
+        stopping = true;
+    }
+    work_available.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+size_t ThreadPool::size() const {
+    return workers.size();
+}
+
+void ThreadPool::submit(std::function<void()> task) {
+    size_t index = next_queue.fetch_add(1) % queues.size();
+    {
+        // Count the task before it becomes visible: otherwise a worker could
+        // take and finish it first and the counters would wrap below zero.
+        // Workers never hold both mutexes at once, so this nesting is safe.
+        std::lock_guard<std::mutex> state_lock(state_mutex);
+        queued_tasks++;
+        pending_tasks++;
+        std::lock_guard<std::mutex> queue_lock(queues[index]->mutex);
+        queues[index]->tasks.push_back(std::move(task));
+    }
+    work_available.notify_one();
+}
+
+void ThreadPool::wait_idle() {
+    std::unique_lock<std::mutex> lock(state_mutex);
+    all_done.wait(lock, [this] { return pending_tasks == 0; });
+}
+
+bool ThreadPool::pop_local(size_t index, std::function<void()>& task) {
+    WorkerQueue& queue = *queues[index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) return false;
+    task = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    return true;
+}
+
+bool ThreadPool::steal(size_t thief_index, std::function<void()>& task) {
+    for (size_t offset = 1; offset < queues.size(); ++offset) {
+        WorkerQueue& victim = *queues[(thief_index + offset) % queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (victim.tasks.empty()) continue;
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::worker_loop(size_t index) {
+    while (true) {
+        std::function<void()> task;
+        if (pop_local(index, task) || steal(index, task)) {
+            {
+                std::lock_guard<std::mutex> lock(state_mutex);
+                queued_tasks--;
+            }
+            try {
+                task();
+            } catch (const std::exception& e) {
+                std::cerr << "Error: Worker task failed: " << e.what() << std::endl;
+            } catch (...) {
+                std::cerr << "Error: Worker task failed with an unknown exception." << std::endl;
+            }
+            std::lock_guard<std::mutex> lock(state_mutex);
+            if (--pending_tasks == 0) {
+                all_done.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(state_mutex);
+        work_available.wait(lock, [this] { return queued_tasks > 0 || stopping; });
+        if (stopping && queued_tasks == 0) return;
+    }
+}
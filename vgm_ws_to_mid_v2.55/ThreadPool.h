@@ -0,0 +1,57 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A small work-stealing thread pool.
+// Every worker owns a task deque: it pops its own work from the back and,
+// once that runs dry, steals from the front of the other workers' deques.
+// This keeps all cores busy even when task costs vary a lot (e.g. a batch of
+// VGM files ranging from a few KB to several MB).
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t num_threads);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Queue a task. Tasks are distributed round-robin over the worker deques.
+    void submit(std::function<void()> task);
+
+    // Block until every submitted task has finished.
+    void wait_idle();
+
+    size_t size() const;
+
+private:
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void worker_loop(size_t index);
+    bool pop_local(size_t index, std::function<void()>& task);
+    bool steal(size_t thief_index, std::function<void()>& task);
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::vector<std::thread> workers;
+    std::atomic<size_t> next_queue{0};
+
+    std::mutex state_mutex;
+    std::condition_variable work_available;
+    std::condition_variable all_done;
+    size_t queued_tasks = 0;   // Submitted but not yet picked up by a worker
+    size_t pending_tasks = 0;  // Submitted but not yet finished
+    bool stopping = false;
+};
+
+#endif // THREAD_POOL_H
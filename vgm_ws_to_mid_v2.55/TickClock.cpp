@@ -0,0 +1,30 @@
+#include "TickClock.h"
+#include <cstdint>
+#include <numeric>
+
+TickClock::TickClock(uint16_t ticks_per_quarter_note, uint32_t tempo_us) {
+    // ppq * 1e6 / (tempo * 44100) with the common factor 100 taken out first,
+    // so num * den stays below 2^63 for any 15-bit PPQ and 24-bit tempo.
+    num = static_cast<uint64_t>(ticks_per_quarter_note) * 10000;
+    den = static_cast<uint64_t>(tempo_us == 0 ? 1 : tempo_us) * 441;
+    uint64_t divisor = std::gcd(num, den);
+    num /= divisor;
+    den /= divisor;
+}
+
+void TickClock::advance(uint64_t samples) {
+    sample_count += samples;
+    if (samples > (UINT64_MAX - den) / num) {
+        // Long jumps (e.g. replayed loops) would overflow samples * num.
+        tick_count = ticks_at(sample_count);
+        remainder = (sample_count % den) * num % den;
+        return;
+    }
+    uint64_t scaled = samples * num + remainder;
+    tick_count += scaled / den;
+    remainder = scaled % den;
+}
+
+uint64_t TickClock::ticks_at(uint64_t sample) const {
+    return (sample / den) * num + (sample % den) * num / den;
+}
@@ -0,0 +1,37 @@
+#ifndef TICK_CLOCK_H
+#define TICK_CLOCK_H
+
+#include <cstdint>
+
+// Maps the VGM sample clock (44100 Hz) to MIDI ticks with an exact rational
+// ratio, ticks = floor(samples * num / den), where num/den is
+// ticks_per_quarter_note * 1e6 / (tempo_us * 44100) in lowest terms. The
+// running position is kept as whole ticks plus a remainder, so it never
+// drifts and advancing costs one multiply and one divide.
+class TickClock {
+public:
+    static constexpr uint32_t SAMPLE_RATE = 44100;
+    static constexpr uint32_t SAMPLES_PER_FRAME = SAMPLE_RATE / 60; // One 60 Hz frame
+
+    // Defaults to 480 ticks per quarter note at 120 BPM (500000 us per quarter).
+    explicit TickClock(uint16_t ticks_per_quarter_note = 480, uint32_t tempo_us = 500000);
+
+    void advance(uint64_t samples);
+    uint64_t samples() const { return sample_count; }
+    uint64_t ticks() const { return tick_count; }
+    // Tick of an arbitrary sample time, computed the same way as the running position.
+    uint64_t ticks_at(uint64_t sample) const;
+
+    // True if every 60 Hz frame wait advances by the same whole number of ticks.
+    bool frames_are_whole_ticks() const { return (SAMPLES_PER_FRAME * num) % den == 0; }
+    double ticks_per_frame() const { return static_cast<double>(SAMPLES_PER_FRAME) * num / den; }
+
+private:
+    uint64_t num;
+    uint64_t den;
+    uint64_t sample_count = 0;
+    uint64_t tick_count = 0;
+    uint64_t remainder = 0; // (sample_count * num) % den
+};
+
+#endif // TICK_CLOCK_H
@@ -10,30 +10,54 @@
 UsageLogger::UsageLogger(const std::string& filename) : filename(filename) {}
 
 void UsageLogger::report_new_instrument(const InstrumentInfo& info) {
-    new_instruments_reported.push_back(info);
+    std::lock_guard<std::mutex> lock(mutex);
+    new_instruments_reported[info.source].push_back(info);
 }
 
 void UsageLogger::write_log(const std::string& vgm_filename,
                               const InstrumentConfig& config,
                               const std::map<int, std::map<std::string, int>>& usage_data) {
-    std::ofstream outfile(filename, std::ios_base::app); // Append to the file
-    if (!outfile.is_open()) {
-        std::cerr << "Error: Could not open log file for writing: " << filename << std::endl;
-        return;
+    std::time_t now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (deferred) {
+            // A file converted again replaces its earlier section.
+            deferred_sections[vgm_filename] = DeferredSection{now, usage_data};
+            return;
+        }
+    }
+    std::string text = format_log(vgm_filename, now, config, usage_data);
+    std::lock_guard<std::mutex> lock(mutex);
+    append_to_file(text);
+}
+
+std::string UsageLogger::format_log(const std::string& vgm_filename,
+                                    std::time_t timestamp,
+                                    const InstrumentConfig& config,
+                                    const std::map<int, std::map<std::string, int>>& usage_data) {
+    std::vector<InstrumentInfo> new_instruments;
+    std::tm local_time;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = new_instruments_reported.find(vgm_filename);
+        if (it != new_instruments_reported.end()) {
+            new_instruments = std::move(it->second);
+            new_instruments_reported.erase(it);
+        }
+        // std::localtime() returns a shared buffer; copy it while holding the lock.
+        local_time = *std::localtime(&timestamp);
     }
 
-    auto now = std::chrono::system_clock::now();
-    auto in_time_t = std::chrono::system_clock::to_time_t(now);
-    
+    std::stringstream outfile;
     outfile << "--- Conversion Log ---" << std::endl;
-    outfile << "Timestamp: " << std::put_time(std::localtime(&in_time_t), "%Y-%m-%d %X") << std::endl;
+    outfile << "Timestamp: " << std::put_time(&local_time, "%Y-%m-%d %X") << std::endl;
     outfile << "Source File: " << vgm_filename << std::endl;
     outfile << std::endl;
 
-    if (!new_instruments_reported.empty()) {
+    if (!new_instruments.empty()) {
         outfile << "New Waveforms Registered:" << std::endl;
-        for (const auto& info : new_instruments_reported) {
-            outfile << "  - " << info.name << " (Fingerprint: " << info.fingerprint << ")" << std::endl;
+        for (const auto& info : new_instruments) {
+            outfile << "  - " << info.name << " (Fingerprint: " << info.fingerprint.to_hex() << ")" << std::endl;
         }
         outfile << std::endl;
     }
@@ -65,4 +89,35 @@ void UsageLogger::write_log(const std::string& vgm_filename,
         }
     }
     outfile << std::endl;
+
+    return outfile.str();
+}
+
+void UsageLogger::begin_deferred() {
+    std::lock_guard<std::mutex> lock(mutex);
+    deferred = true;
+}
+
+void UsageLogger::end_deferred(const InstrumentConfig& config) {
+    std::map<std::string, DeferredSection> sections;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        sections.swap(deferred_sections);
+        deferred = false;
+    }
+    std::string text;
+    for (const auto& pair : sections) {
+        text += format_log(pair.first, pair.second.timestamp, config, pair.second.usage_data);
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!text.empty()) append_to_file(text);
+}
+
+void UsageLogger::append_to_file(const std::string& text) {
+    std::ofstream outfile(filename, std::ios_base::app); // Append to the file
+    if (!outfile.is_open()) {
+        std::cerr << "Error: Could not open log file for writing: " << filename << std::endl;
+        return;
+    }
+    outfile << text;
 }
@@ -4,8 +4,11 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <mutex>
+#include <ctime>
 #include "InstrumentConfig.h" // For InstrumentInfo
 
+// Thread-safe: several conversions may report and log concurrently.
 class UsageLogger {
 public:
     UsageLogger(const std::string& filename);
@@ -18,9 +21,30 @@ public:
                    const InstrumentConfig& config,
                    const std::map<int, std::map<std::string, int>>& usage_data);
 
+    // While deferred, log sections are held back and written by end_deferred()
+    // ordered by source file name, so parallel batches produce a stable log.
+    // Instrument names are only looked up then, after the batch's waveforms
+    // have been registered (see InstrumentConfig::end_deferred()).
+    void begin_deferred();
+    void end_deferred(const InstrumentConfig& config);
+
 private:
+    struct DeferredSection {
+        std::time_t timestamp;
+        std::map<int, std::map<std::string, int>> usage_data;
+    };
+
+    std::string format_log(const std::string& vgm_filename,
+                           std::time_t timestamp,
+                           const InstrumentConfig& config,
+                           const std::map<int, std::map<std::string, int>>& usage_data);
+    void append_to_file(const std::string& text);
+
     std::string filename;
-    std::vector<InstrumentInfo> new_instruments_reported;
+    std::map<std::string, std::vector<InstrumentInfo>> new_instruments_reported; // Keyed by source file
+    bool deferred = false;
+    std::map<std::string, DeferredSection> deferred_sections;
+    std::mutex mutex;
 };
 
 #endif // USAGE_LOGGER_H
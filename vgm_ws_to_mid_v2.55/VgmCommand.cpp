@@ -0,0 +1,69 @@
+#include "VgmCommand.h"
+#include "VgmOpcodeTable.h"
+#include <iostream>
+
+bool parse_vgm_header(const uint8_t* data, size_t size, VgmHeader& header) {
+    if (size < 0x40) {
+        std::cerr << "Invalid VGM file: header too small." << std::endl;
+        return false;
+    }
+
+    if (data[0] != 'V' || data[1] != 'g' || data[2] != 'm' || data[3] != ' ') {
+        std::cerr << "Invalid VGM file: magic number mismatch." << std::endl;
+        return false;
+    }
+
+    uint32_t vgm_data_offset_val = *reinterpret_cast<const uint32_t*>(&data[0x34]);
+    header.data_offset = (vgm_data_offset_val == 0) ? 0x40 : (0x34 + vgm_data_offset_val);
+
+    uint32_t loop_offset_val = *reinterpret_cast<const uint32_t*>(&data[0x1C]);
+    header.loop_offset = (loop_offset_val != 0) ? 0x1C + loop_offset_val : 0;
+    return true;
+}
+
+bool decode_vgm_command(const uint8_t* data, size_t available, VgmCommand& command) {
+    if (available == 0) return false;
+
+    uint8_t opcode = data[0];
+    const VgmOpcodeInfo& info = VGM_OPCODE_TABLE[opcode];
+    command = VgmCommand{};
+    command.opcode = opcode;
+    command.header_length = info.length;
+    command.length = info.length;
+
+    // A command whose operands run past the end of the data is treated as the end of the stream.
+    if (available < info.length) return false;
+
+    switch (info.kind) {
+        case VgmOpcodeKind::Wait:
+            command.type = VgmCommandType::Wait;
+            command.wait_samples = info.wait_samples;
+            break;
+        case VgmOpcodeKind::WaitWord:
+            command.type = VgmCommandType::Wait;
+            command.wait_samples = static_cast<uint32_t>(data[1] | (data[2] << 8));
+            break;
+        case VgmOpcodeKind::PortWrite:
+            command.type = VgmCommandType::PortWrite;
+            command.address = 0x80 + data[1];
+            command.value = data[2];
+            break;
+        case VgmOpcodeKind::RamWrite:
+            command.type = VgmCommandType::RamWrite;
+            command.address = static_cast<uint16_t>((data[1] << 8) | data[2]);
+            command.value = data[3];
+            break;
+        case VgmOpcodeKind::End:
+            command.type = VgmCommandType::End;
+            break;
+        case VgmOpcodeKind::DataBlock: {
+            // 0x67 0x66 tt ss ss ss ss: data block of type tt, little-endian size
+            uint32_t block_size = data[3] | (data[4] << 8) | (data[5] << 16) | (static_cast<uint32_t>(data[6]) << 24);
+            command.length = 7 + static_cast<uint64_t>(block_size);
+            break;
+        }
+        case VgmOpcodeKind::Skip:
+            break;
+    }
+    return true;
+}
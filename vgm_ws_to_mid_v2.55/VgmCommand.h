@@ -0,0 +1,40 @@
+#ifndef VGM_COMMAND_H
+#define VGM_COMMAND_H
+
+#include <cstdint>
+#include <cstddef>
+
+enum class VgmCommandType : uint8_t {
+    Wait,       // Advance time by wait_samples
+    PortWrite,  // 0xBC: WonderSwan I/O port write (address = port, already offset by 0x80)
+    RamWrite,   // 0xC6: WonderSwan internal RAM write
+    End,        // 0x66: End of sound data (loop point handling is up to the caller)
+    Skip        // Any other command; only its length matters
+};
+
+struct VgmCommand {
+    VgmCommandType type = VgmCommandType::Skip;
+    uint8_t opcode = 0;
+    uint8_t value = 0;
+    uint16_t address = 0;
+    uint32_t wait_samples = 0;
+    uint64_t length = 1;        // Total size in bytes, including any data block payload
+    uint32_t header_length = 1; // Bytes that must be readable to decode the command
+};
+
+struct VgmHeader {
+    uint32_t data_offset = 0x40;
+    uint32_t loop_offset = 0; // 0 = no loop
+};
+
+// Validates the VGM header at `data` (at least 0x40 bytes are needed) and
+// resolves the relative data/loop offsets to absolute file offsets.
+bool parse_vgm_header(const uint8_t* data, size_t size, VgmHeader& header);
+
+// Decodes the command at `data`, where `available` bytes are readable.
+// Lengths come from VGM_OPCODE_TABLE, so unknown commands are stepped over correctly.
+// Only the header is read, so data block payloads need not be resident.
+// Returns false if the command is truncated.
+bool decode_vgm_command(const uint8_t* data, size_t available, VgmCommand& command);
+
+#endif // VGM_COMMAND_H
@@ -0,0 +1,62 @@
+#include "VgmCommandStream.h"
+
+void VgmCommandStream::decode(ByteView data, uint32_t data_offset, uint32_t loop_offset) {
+    types.clear();
+    opcodes.clear();
+    operands.clear();
+    sample_times.clear();
+    offsets.clear();
+    loop_index = NO_LOOP;
+
+    // WonderSwan commands are 1-4 bytes long; reserve a rough estimate to limit regrowth.
+    size_t estimate = data.size() > data_offset ? (data.size() - data_offset) / 3 : 0;
+    types.reserve(estimate);
+    opcodes.reserve(estimate);
+    operands.reserve(estimate);
+    sample_times.reserve(estimate);
+    offsets.reserve(estimate);
+
+    size_t current_pos = data_offset;
+    size_t end_pos = data.size();
+    uint64_t current_sample = 0;
+    VgmCommand command;
+
+    while (current_pos < end_pos) {
+        if (!decode_vgm_command(&data[current_pos], end_pos - current_pos, command)) break;
+
+        if (loop_index == NO_LOOP && loop_offset != 0 && current_pos >= loop_offset) {
+            loop_index = types.size();
+        }
+
+        uint32_t operand_value = 0;
+        switch (command.type) {
+            case VgmCommandType::Wait:
+                operand_value = command.wait_samples;
+                break;
+            case VgmCommandType::PortWrite:
+            case VgmCommandType::RamWrite:
+                operand_value = (static_cast<uint32_t>(command.address) << 8) | command.value;
+                break;
+            case VgmCommandType::End:
+                break;
+            default:
+                current_pos += command.length;
+                continue; // Not relevant to the WonderSwan
+        }
+
+        types.push_back(static_cast<uint8_t>(command.type));
+        opcodes.push_back(command.opcode);
+        operands.push_back(operand_value);
+        sample_times.push_back(current_sample);
+        offsets.push_back(static_cast<uint32_t>(current_pos));
+
+        if (command.type == VgmCommandType::End) break;
+        if (command.type == VgmCommandType::Wait) current_sample += command.wait_samples;
+        current_pos += command.length;
+    }
+
+    // A loop point past the end marker can never be reached.
+    if (loop_index != NO_LOOP && loop_index >= types.size()) {
+        loop_index = NO_LOOP;
+    }
+}
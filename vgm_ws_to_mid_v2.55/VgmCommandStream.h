@@ -0,0 +1,48 @@
+#ifndef VGM_COMMAND_STREAM_H
+#define VGM_COMMAND_STREAM_H
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "VgmCommand.h"
+#include "MappedFile.h"
+
+// The VGM data region decoded once into a compact struct-of-arrays form.
+// Only commands that matter to the WonderSwan (waits, port/RAM writes and
+// the end marker) are kept; everything else is dropped during decoding.
+// The converter and the command dumper consume this instead of re-parsing
+// bytes, and loops are replayed by jumping back to loop_index.
+class VgmCommandStream {
+public:
+    static constexpr size_t NO_LOOP = static_cast<size_t>(-1);
+
+    // Decodes from data_offset up to the first 0x66 (or the end of the data).
+    void decode(ByteView data, uint32_t data_offset, uint32_t loop_offset);
+
+    size_t size() const { return types.size(); }
+    bool has_loop() const { return loop_index != NO_LOOP; }
+    // Index of the first command at or after the header's loop offset.
+    size_t get_loop_index() const { return loop_index; }
+
+    VgmCommandType type(size_t index) const { return static_cast<VgmCommandType>(types[index]); }
+    // Wait: samples. PortWrite/RamWrite: (address << 8) | value.
+    uint32_t operand(size_t index) const { return operands[index]; }
+    uint32_t wait_samples(size_t index) const { return operands[index]; }
+    uint16_t address(size_t index) const { return static_cast<uint16_t>(operands[index] >> 8); }
+    uint8_t value(size_t index) const { return static_cast<uint8_t>(operands[index] & 0xFF); }
+    // Sample time at which the command executes on the first pass.
+    uint64_t sample_time(size_t index) const { return sample_times[index]; }
+    // File offset of the command, for diagnostics.
+    uint32_t offset(size_t index) const { return offsets[index]; }
+    uint8_t opcode(size_t index) const { return opcodes[index]; }
+
+private:
+    std::vector<uint8_t> types;
+    std::vector<uint8_t> opcodes;
+    std::vector<uint32_t> operands;
+    std::vector<uint64_t> sample_times;
+    std::vector<uint32_t> offsets;
+    size_t loop_index = NO_LOOP;
+};
+
+#endif // VGM_COMMAND_STREAM_H
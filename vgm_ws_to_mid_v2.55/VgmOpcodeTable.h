@@ -0,0 +1,75 @@
+#ifndef VGM_OPCODE_TABLE_H
+#define VGM_OPCODE_TABLE_H
+
+#include <array>
+#include <cstdint>
+
+// How the decoder treats an opcode once its length is known.
+enum class VgmOpcodeKind : uint8_t {
+    Skip,       // Command for another chip / unsupported feature: just step over it
+    Wait,       // Fixed wait, stored in VgmOpcodeInfo::wait_samples
+    WaitWord,   // 0x61 nn nn
+    PortWrite,  // 0xBC aa dd
+    RamWrite,   // 0xC6 mm ll dd
+    End,        // 0x66
+    DataBlock   // 0x67 0x66 tt ss ss ss ss, followed by the payload
+};
+
+struct VgmOpcodeInfo {
+    uint8_t length = 1;        // Command length in bytes (header only for data blocks)
+    VgmOpcodeKind kind = VgmOpcodeKind::Skip;
+    uint16_t wait_samples = 0; // For VgmOpcodeKind::Wait
+};
+
+// Built from the VGM 1.71 command list. Opcodes the spec leaves undefined
+// are treated as single-byte commands.
+constexpr std::array<VgmOpcodeInfo, 256> make_vgm_opcode_table() {
+    std::array<VgmOpcodeInfo, 256> table{};
+    auto set_range = [&table](int first, int last, uint8_t length) {
+        for (int op = first; op <= last; ++op) table[op] = VgmOpcodeInfo{length, VgmOpcodeKind::Skip, 0};
+    };
+
+    set_range(0x30, 0x3F, 2);  // Reserved, one operand (dual-chip SN76489 writes)
+    set_range(0x40, 0x4E, 3);  // Reserved / Mikey, two operands
+    set_range(0x4F, 0x50, 2);  // Game Gear stereo, SN76489
+    set_range(0x51, 0x5F, 3);  // YM-family register writes
+    set_range(0xA0, 0xBF, 3);  // AY8910 and other aa dd writes
+    set_range(0xC0, 0xDF, 4);  // Sega PCM, RF5C68, ... (mm ll dd / pp aa dd)
+    set_range(0xE0, 0xFF, 5);  // PCM seek, C352, reserved four-operand commands
+
+    table[0x61] = VgmOpcodeInfo{3, VgmOpcodeKind::WaitWord, 0};
+    table[0x62] = VgmOpcodeInfo{1, VgmOpcodeKind::Wait, 735};
+    table[0x63] = VgmOpcodeInfo{1, VgmOpcodeKind::Wait, 882};
+    table[0x64] = VgmOpcodeInfo{4, VgmOpcodeKind::Skip, 0};  // Override 0x62/0x63 length
+    table[0x66] = VgmOpcodeInfo{1, VgmOpcodeKind::End, 0};
+    table[0x67] = VgmOpcodeInfo{7, VgmOpcodeKind::DataBlock, 0};
+    table[0x68] = VgmOpcodeInfo{12, VgmOpcodeKind::Skip, 0}; // PCM RAM write
+
+    for (int n = 0; n < 16; ++n) {
+        table[0x70 + n] = VgmOpcodeInfo{1, VgmOpcodeKind::Wait, static_cast<uint16_t>(n + 1)};
+        // YM2612 DAC write from the data bank, then wait n samples
+        table[0x80 + n] = VgmOpcodeInfo{1, n == 0 ? VgmOpcodeKind::Skip : VgmOpcodeKind::Wait, static_cast<uint16_t>(n)};
+    }
+
+    // DAC stream control
+    table[0x90] = VgmOpcodeInfo{5, VgmOpcodeKind::Skip, 0};
+    table[0x91] = VgmOpcodeInfo{5, VgmOpcodeKind::Skip, 0};
+    table[0x92] = VgmOpcodeInfo{6, VgmOpcodeKind::Skip, 0};
+    table[0x93] = VgmOpcodeInfo{11, VgmOpcodeKind::Skip, 0};
+    table[0x94] = VgmOpcodeInfo{2, VgmOpcodeKind::Skip, 0};
+    table[0x95] = VgmOpcodeInfo{5, VgmOpcodeKind::Skip, 0};
+
+    table[0xBC] = VgmOpcodeInfo{3, VgmOpcodeKind::PortWrite, 0};
+    table[0xC6] = VgmOpcodeInfo{4, VgmOpcodeKind::RamWrite, 0};
+    return table;
+}
+
+inline constexpr std::array<VgmOpcodeInfo, 256> VGM_OPCODE_TABLE = make_vgm_opcode_table();
+
+static_assert(VGM_OPCODE_TABLE[0x61].length == 3, "0x61 takes a 16-bit wait");
+static_assert(VGM_OPCODE_TABLE[0x93].length == 11, "0x93 starts a DAC stream with 10 operand bytes");
+static_assert(VGM_OPCODE_TABLE[0xB3].length == 3, "0xB3 is a Game Boy DMG write");
+static_assert(VGM_OPCODE_TABLE[0xC6].kind == VgmOpcodeKind::RamWrite, "0xC6 is the WonderSwan RAM write");
+static_assert(VGM_OPCODE_TABLE[0xE0].length == 5, "0xE0 carries a 32-bit offset");
+
+#endif // VGM_OPCODE_TABLE_H
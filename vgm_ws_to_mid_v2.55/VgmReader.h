@@ -4,22 +4,26 @@
 #include <string>
 #include <vector>
 #include <cstdint>
-#include "WonderSwanChip.h"
+#include "MappedFile.h"
 
 class VgmReader {
 public:
-    VgmReader(WonderSwanChip& chip);
+    VgmReader() = default;
     bool load_and_parse(const std::string& filename);
     uint32_t get_loop_offset() const;
     uint32_t get_data_offset() const;
-    const std::vector<uint8_t>& get_data() const;
+    // View of the whole file. It points into the memory-mapped file when
+    // mapping succeeded, otherwise into an owned buffer; valid while the reader lives.
+    ByteView get_data() const;
 
 private:
-    WonderSwanChip& chip;
-    std::vector<uint8_t> file_data;
+    MappedFile mapped_file;
+    std::vector<uint8_t> file_data; // Fallback buffer when mapping is unavailable
+    ByteView data_view;
     uint32_t loop_offset = 0;
     uint32_t data_offset = 0;
     bool parse();
+    bool inflate_gzip(const std::string& filename);
 };
 
 #endif // VGM_READER_H
@@ -0,0 +1,51 @@
+#include "VgmSource.h"
+#include <zlib.h>
+#include <algorithm>
+
+VgmSource::~VgmSource() {
+    close();
+}
+
+bool VgmSource::open(const std::string& filename) {
+    close();
+    file = gzopen(filename.c_str(), "rb");
+    if (file == nullptr) return false;
+    gzbuffer(file, 64 * 1024);
+    return true;
+}
+
+void VgmSource::close() {
+    if (file != nullptr) {
+        gzclose(file);
+        file = nullptr;
+    }
+}
+
+size_t VgmSource::read(uint8_t* buffer, size_t count) {
+    if (file == nullptr || count == 0) return 0;
+    size_t total = 0;
+    while (total < count) {
+        // gzread takes an unsigned int length, so feed very large requests in pieces.
+        unsigned int chunk = static_cast<unsigned int>(std::min<size_t>(count - total, 1u << 30));
+        int got = gzread(file, buffer + total, chunk);
+        if (got <= 0) break;
+        total += static_cast<size_t>(got);
+    }
+    return total;
+}
+
+bool VgmSource::seek(uint64_t offset) {
+    if (file == nullptr) return false;
+    return gzseek(file, static_cast<z_off_t>(offset), SEEK_SET) == static_cast<z_off_t>(offset);
+}
+
+bool VgmSource::skip(uint64_t count) {
+    if (file == nullptr) return false;
+    return seek(tell() + count);
+}
+
+uint64_t VgmSource::tell() const {
+    if (file == nullptr) return 0;
+    z_off_t position = gztell(file);
+    return position < 0 ? 0 : static_cast<uint64_t>(position);
+}
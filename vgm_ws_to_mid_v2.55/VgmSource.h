@@ -0,0 +1,36 @@
+#ifndef VGM_SOURCE_H
+#define VGM_SOURCE_H
+
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+struct gzFile_s;
+
+// Sequential byte source for VGM data. Reads plain .vgm files and
+// gzip-compressed .vgz files alike (zlib passes uncompressed data through).
+class VgmSource {
+public:
+    VgmSource() = default;
+    ~VgmSource();
+    VgmSource(const VgmSource&) = delete;
+    VgmSource& operator=(const VgmSource&) = delete;
+
+    bool open(const std::string& filename);
+    void close();
+    bool is_open() const { return file != nullptr; }
+
+    // Reads up to `count` bytes; returns the number read (0 at end of file or on error).
+    size_t read(uint8_t* buffer, size_t count);
+    // Repositions to an absolute offset in the uncompressed stream.
+    // Seeking backwards in a compressed file restarts decompression from the beginning.
+    bool seek(uint64_t offset);
+    // Skips forward without copying the data anywhere.
+    bool skip(uint64_t count);
+    uint64_t tell() const;
+
+private:
+    gzFile_s* file = nullptr;
+};
+
+#endif // VGM_SOURCE_H
@@ -0,0 +1,106 @@
+#include "VgmStreamReader.h"
+#include "VgmOpcodeTable.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+bool VgmStreamReader::open(const std::string& filename) {
+    if (!source.open(filename)) {
+        std::cerr << "Cannot open file: " << filename << std::endl;
+        return false;
+    }
+    ring_head = 0;
+    ring_count = 0;
+    stream_position = 0;
+    source_exhausted = false;
+
+    fill(0x40);
+    uint8_t header_bytes[0x40];
+    size_t header_size = std::min(ring_count, sizeof(header_bytes));
+    for (size_t i = 0; i < header_size; ++i) {
+        header_bytes[i] = ring[(ring_head + i) % BUFFER_SIZE];
+    }
+
+    VgmHeader header;
+    if (!parse_vgm_header(header_bytes, header_size, header)) {
+        return false;
+    }
+    data_offset = header.data_offset;
+    loop_offset = header.loop_offset;
+
+    return seek(data_offset);
+}
+
+uint32_t VgmStreamReader::get_loop_offset() const {
+    return loop_offset;
+}
+
+uint32_t VgmStreamReader::get_data_offset() const {
+    return data_offset;
+}
+
+uint64_t VgmStreamReader::get_position() const {
+    return stream_position;
+}
+
+bool VgmStreamReader::fill(size_t needed) {
+    needed = std::min(needed, BUFFER_SIZE);
+    while (ring_count < needed && !source_exhausted) {
+        size_t tail = (ring_head + ring_count) % BUFFER_SIZE;
+        // Read into the contiguous free region after the tail.
+        size_t contiguous_free = (tail >= ring_head) ? BUFFER_SIZE - tail : ring_head - tail;
+        contiguous_free = std::min(contiguous_free, BUFFER_SIZE - ring_count);
+        size_t got = source.read(ring.data() + tail, contiguous_free);
+        if (got == 0) {
+            source_exhausted = true;
+            break;
+        }
+        ring_count += got;
+    }
+    return ring_count >= needed;
+}
+
+void VgmStreamReader::consume(size_t count) {
+    ring_head = (ring_head + count) % BUFFER_SIZE;
+    ring_count -= count;
+    stream_position += count;
+}
+
+bool VgmStreamReader::skip(uint64_t count) {
+    if (count <= ring_count) {
+        consume(static_cast<size_t>(count));
+        return true;
+    }
+    return seek(stream_position + count);
+}
+
+bool VgmStreamReader::seek(uint64_t offset) {
+    // Stay inside the buffered window when possible.
+    if (offset >= stream_position && offset - stream_position <= ring_count) {
+        consume(static_cast<size_t>(offset - stream_position));
+        return true;
+    }
+    ring_head = 0;
+    ring_count = 0;
+    stream_position = offset;
+    source_exhausted = !source.seek(offset);
+    return !source_exhausted;
+}
+
+bool VgmStreamReader::next_command(VgmCommand& command) {
+    if (!fill(1)) return false;
+
+    uint8_t opcode = ring[ring_head];
+    fill(VGM_OPCODE_TABLE[opcode].length);
+
+    // Commands are at most a few bytes long; copy the header out so it is
+    // contiguous even when it wraps around the end of the ring.
+    uint8_t header[16];
+    size_t available = std::min(ring_count, sizeof(header));
+    size_t first_part = std::min(available, BUFFER_SIZE - ring_head);
+    std::memcpy(header, ring.data() + ring_head, first_part);
+    std::memcpy(header + first_part, ring.data(), available - first_part);
+
+    if (!decode_vgm_command(header, available, command)) return false;
+    return skip(command.length);
+}
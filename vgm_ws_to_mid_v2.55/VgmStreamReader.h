@@ -0,0 +1,47 @@
+#ifndef VGM_STREAM_READER_H
+#define VGM_STREAM_READER_H
+
+#include <string>
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include "VgmSource.h"
+#include "VgmCommand.h"
+
+// Decodes VGM commands from a VgmSource through a fixed-size ring buffer,
+// so memory use does not depend on the length of the file. Data block
+// payloads are skipped in the source instead of being buffered.
+class VgmStreamReader {
+public:
+    static constexpr size_t BUFFER_SIZE = 64 * 1024;
+
+    VgmStreamReader() = default;
+
+    // Opens the file and parses the header; positions the stream at the first command.
+    bool open(const std::string& filename);
+    uint32_t get_loop_offset() const;
+    uint32_t get_data_offset() const;
+    // File offset of the next command.
+    uint64_t get_position() const;
+
+    // Decodes the next command. Returns false at the end of the data or on a truncated command.
+    bool next_command(VgmCommand& command);
+    // Jumps to an absolute file offset, e.g. the loop point after a 0x66.
+    bool seek(uint64_t offset);
+
+private:
+    bool fill(size_t needed);
+    void consume(size_t count);
+    bool skip(uint64_t count);
+
+    VgmSource source;
+    std::array<uint8_t, BUFFER_SIZE> ring{};
+    size_t ring_head = 0;        // Index of the first buffered byte
+    size_t ring_count = 0;       // Number of buffered bytes
+    uint64_t stream_position = 0; // File offset of ring[ring_head]
+    bool source_exhausted = false;
+    uint32_t loop_offset = 0;
+    uint32_t data_offset = 0;
+};
+
+#endif // VGM_STREAM_READER_H
@@ -0,0 +1,87 @@
+#include "WaveFingerprint.h"
+#include <algorithm>
+
+WaveFingerprint WaveFingerprint::from_samples(const std::array<uint8_t, 32>& samples) {
+    WaveFingerprint fp;
+    for (size_t i = 0; i < 16; ++i) {
+        fp.hi = (fp.hi << 4) | (samples[i] & 0x0F);
+        fp.lo = (fp.lo << 4) | (samples[i + 16] & 0x0F);
+    }
+    return fp;
+}
+
+WaveFingerprint WaveFingerprint::from_wave_ram(const uint8_t* bytes) {
+    // Each RAM byte holds two samples, the earlier one in the low nibble.
+    WaveFingerprint fp;
+    for (size_t i = 0; i < 8; ++i) {
+        uint8_t a = bytes[i], b = bytes[i + 8];
+        fp.hi = (fp.hi << 8) | static_cast<uint8_t>((a << 4) | (a >> 4));
+        fp.lo = (fp.lo << 8) | static_cast<uint8_t>((b << 4) | (b >> 4));
+    }
+    return fp;
+}
+
+WaveFingerprint WaveFingerprint::canonical() const {
+    std::array<uint8_t, 32> samples = to_samples();
+    uint8_t lowest = *std::min_element(samples.begin(), samples.end());
+    for (uint8_t& sample : samples) sample -= lowest;
+
+    // Minimum rotation: i and j are the two best candidate starts and k the
+    // length of their common prefix. On a mismatch the losing candidate skips
+    // past the compared prefix, so each advances at most 32 times in total.
+    const size_t n = samples.size();
+    size_t i = 0, j = 1, k = 0;
+    while (i < n && j < n && k < n) {
+        uint8_t a = samples[(i + k) % n];
+        uint8_t b = samples[(j + k) % n];
+        if (a == b) {
+            ++k;
+            continue;
+        }
+        if (a > b) i += k + 1;
+        else j += k + 1;
+        if (i == j) ++j;
+        k = 0;
+    }
+    std::rotate(samples.begin(), samples.begin() + std::min(i, j), samples.end());
+    return from_samples(samples);
+}
+
+static int hex_digit_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+bool WaveFingerprint::from_hex(const std::string& text, WaveFingerprint& out) {
+    if (text.size() != 64) return false;
+    WaveFingerprint fp;
+    for (size_t i = 0; i < 32; ++i) {
+        // Samples are 4-bit, so the high digit of every byte must be zero.
+        if (text[i * 2] != '0') return false;
+        int value = hex_digit_value(text[i * 2 + 1]);
+        if (value < 0) return false;
+        uint64_t& word = i < 16 ? fp.hi : fp.lo;
+        word = (word << 4) | static_cast<uint64_t>(value);
+    }
+    out = fp;
+    return true;
+}
+
+std::string WaveFingerprint::to_hex() const {
+    static const char digits[] = "0123456789abcdef";
+    std::string text(64, '0');
+    for (size_t i = 0; i < 32; ++i) {
+        text[i * 2 + 1] = digits[sample(i)];
+    }
+    return text;
+}
+
+std::array<uint8_t, 32> WaveFingerprint::to_samples() const {
+    std::array<uint8_t, 32> samples;
+    for (size_t i = 0; i < 32; ++i) {
+        samples[i] = sample(i);
+    }
+    return samples;
+}
@@ -0,0 +1,52 @@
+#ifndef WAVE_FINGERPRINT_H
+#define WAVE_FINGERPRINT_H
+
+#include <array>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+
+// Identity of a 32-sample, 4-bit wavetable packed into 128 bits.
+// Sample 0 occupies the most significant nibble of `hi`, so comparing
+// (hi, lo) orders fingerprints exactly like their hex strings.
+struct WaveFingerprint {
+    uint64_t hi = 0;
+    uint64_t lo = 0;
+
+    static WaveFingerprint from_samples(const std::array<uint8_t, 32>& samples);
+    // Packs the 16 bytes of a wavetable in WonderSwan RAM (low nibble first).
+    static WaveFingerprint from_wave_ram(const uint8_t* bytes);
+    // Parses the 64-character form used in instruments.ini ("0f0e..."), one
+    // byte per sample. Returns false if the text is not a valid fingerprint.
+    static bool from_hex(const std::string& text, WaveFingerprint& out);
+
+    // Representative shared by all rotations and DC offsets of a waveform:
+    // the lowest sample is moved to 0, then the lexicographically smallest
+    // rotation is taken. Runs in linear time over the 32 samples.
+    WaveFingerprint canonical() const;
+
+    std::string to_hex() const;
+    std::array<uint8_t, 32> to_samples() const;
+    uint8_t sample(size_t index) const {
+        uint64_t word = index < 16 ? hi : lo;
+        return static_cast<uint8_t>((word >> ((15 - (index & 15)) * 4)) & 0x0F);
+    }
+
+    bool operator==(const WaveFingerprint& other) const { return hi == other.hi && lo == other.lo; }
+    bool operator!=(const WaveFingerprint& other) const { return !(*this == other); }
+    bool operator<(const WaveFingerprint& other) const {
+        return hi != other.hi ? hi < other.hi : lo < other.lo;
+    }
+};
+
+struct WaveFingerprintHash {
+    size_t operator()(const WaveFingerprint& fp) const {
+        uint64_t h = fp.hi * 0x9E3779B97F4A7C15ULL ^ (fp.lo + 0x632BE59BD9B4E019ULL);
+        h ^= h >> 29;
+        h *= 0xBF58476D1CE4E5B9ULL;
+        h ^= h >> 32;
+        return static_cast<size_t>(h);
+    }
+};
+
+#endif // WAVE_FINGERPRINT_H
@@ -0,0 +1,118 @@
+#include "WaveformIndex.h"
+#include <algorithm>
+
+// First sample of each block; 32 samples in 7 blocks of 5 or 4.
+static const int BLOCK_START[WaveformIndex::MAX_DISTANCE + 2] = {0, 5, 10, 15, 20, 24, 28, 32};
+
+void WaveformIndex::clear() {
+    fingerprints.clear();
+    names.clear();
+    slots.clear();
+    used_slots = 0;
+}
+
+uint32_t WaveformIndex::block_key(const WaveFingerprint& fingerprint, int block) {
+    // Samples [start, end) as consecutive nibbles; block 3 spans both words.
+    int start = BLOCK_START[block], end = BLOCK_START[block + 1];
+    int bits = (end - start) * 4;
+    uint64_t value;
+    if (end <= 16) {
+        value = fingerprint.hi >> ((16 - end) * 4);
+    } else if (start >= 16) {
+        value = fingerprint.lo >> ((32 - end) * 4);
+    } else {
+        int lo_bits = (end - 16) * 4;
+        value = (fingerprint.hi << lo_bits) | (fingerprint.lo >> (64 - lo_bits));
+    }
+    return (static_cast<uint32_t>(block) << 20) | static_cast<uint32_t>(value & ((1ULL << bits) - 1));
+}
+
+size_t WaveformIndex::slot_of(uint32_t key, size_t mask) {
+    return static_cast<size_t>((key * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+}
+
+void WaveformIndex::insert(uint32_t key, uint32_t index) {
+    size_t mask = slots.size() - 1;
+    size_t slot = slot_of(key, mask);
+    while (slots[slot] != 0) slot = (slot + 1) & mask;
+    slots[slot] = (static_cast<uint64_t>(key) << 32) | (index + 1);
+    used_slots++;
+}
+
+void WaveformIndex::grow() {
+    // Keep the table at most half full so probe runs stay short.
+    std::vector<uint64_t> old_slots;
+    old_slots.swap(slots);
+    slots.assign(old_slots.empty() ? 256 : old_slots.size() * 2, 0);
+    used_slots = 0;
+    for (uint64_t entry : old_slots) {
+        if (entry != 0) insert(static_cast<uint32_t>(entry >> 32), static_cast<uint32_t>(entry) - 1);
+    }
+}
+
+void WaveformIndex::add(const WaveFingerprint& fingerprint, const std::string& name) {
+    uint32_t index = static_cast<uint32_t>(fingerprints.size());
+    fingerprints.push_back(fingerprint);
+    names.push_back(name);
+    for (int block = 0; block <= MAX_DISTANCE; ++block) {
+        if ((used_slots + 1) * 2 > slots.size()) grow();
+        insert(block_key(fingerprint, block), index);
+    }
+}
+
+static int count_nonzero_nibbles(uint64_t x) {
+    // Fold every nibble onto its lowest bit, then add the bits up per byte.
+    x |= x >> 1;
+    x |= x >> 2;
+    x &= 0x1111111111111111ULL;
+    x = (x & 0x0F0F0F0F0F0F0F0FULL) + ((x >> 4) & 0x0F0F0F0F0F0F0F0FULL);
+    return static_cast<int>((x * 0x0101010101010101ULL) >> 56);
+}
+
+int WaveformIndex::distance(const WaveFingerprint& a, const WaveFingerprint& b) {
+    return count_nonzero_nibbles(a.hi ^ b.hi) + count_nonzero_nibbles(a.lo ^ b.lo);
+}
+
+bool WaveformIndex::find_nearest(const WaveFingerprint& query, int max_distance, WaveFingerprint& match) const {
+    if (max_distance > MAX_DISTANCE) max_distance = MAX_DISTANCE;
+    if (max_distance < 0) return false;
+
+    int best_distance = max_distance + 1;
+    const std::string* best_name = nullptr;
+    if (slots.empty()) return false;
+    size_t mask = slots.size() - 1;
+    for (int block = 0; block <= MAX_DISTANCE; ++block) {
+        uint32_t key = block_key(query, block);
+        // An entry sharing several blocks is seen several times; that only repeats the comparison.
+        for (size_t slot = slot_of(key, mask); slots[slot] != 0; slot = (slot + 1) & mask) {
+            if (static_cast<uint32_t>(slots[slot] >> 32) != key) continue;
+            uint32_t index = static_cast<uint32_t>(slots[slot]) - 1;
+            int d = distance(query, fingerprints[index]);
+            if (d < best_distance || (d == best_distance && best_name != nullptr && names[index] < *best_name)) {
+                best_distance = d;
+                best_name = &names[index];
+                match = fingerprints[index];
+            }
+        }
+    }
+    return best_name != nullptr;
+}
+
+void WaveformIndex::find_within(const WaveFingerprint& query, int max_distance, std::vector<uint32_t>& indices) const {
+    indices.clear();
+    if (max_distance > MAX_DISTANCE) max_distance = MAX_DISTANCE;
+    if (max_distance < 0 || slots.empty()) return;
+    size_t mask = slots.size() - 1;
+    for (int block = 0; block <= MAX_DISTANCE; ++block) {
+        uint32_t key = block_key(query, block);
+        for (size_t slot = slot_of(key, mask); slots[slot] != 0; slot = (slot + 1) & mask) {
+            if (static_cast<uint32_t>(slots[slot] >> 32) != key) continue;
+            uint32_t index = static_cast<uint32_t>(slots[slot]) - 1;
+            if (distance(query, fingerprints[index]) <= max_distance) {
+                indices.push_back(index);
+            }
+        }
+    }
+    std::sort(indices.begin(), indices.end());
+    indices.erase(std::unique(indices.begin(), indices.end()), indices.end());
+}
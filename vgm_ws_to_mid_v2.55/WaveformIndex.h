@@ -0,0 +1,50 @@
+#ifndef WAVEFORM_INDEX_H
+#define WAVEFORM_INDEX_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "WaveFingerprint.h"
+
+// Nearest-neighbour search over wavetables, where the distance is the number
+// of samples that differ. Uses multi-index hashing: the 32 samples are split
+// into MAX_DISTANCE + 1 blocks, and two waveforms that differ in at most
+// MAX_DISTANCE samples agree exactly on at least one block. A query therefore
+// only compares against entries that share a block with it, instead of
+// scanning every known waveform.
+class WaveformIndex {
+public:
+    static constexpr int MAX_DISTANCE = 6;
+
+    void clear();
+    void add(const WaveFingerprint& fingerprint, const std::string& name);
+    size_t size() const { return fingerprints.size(); }
+
+    // Finds the closest entry that differs in at most `max_distance` samples
+    // (capped at MAX_DISTANCE); ties go to the entry with the smaller name.
+    bool find_nearest(const WaveFingerprint& query, int max_distance, WaveFingerprint& match) const;
+
+    // Indices (in the order entries were added) of every entry that differs
+    // from `query` in at most `max_distance` samples, ascending.
+    void find_within(const WaveFingerprint& query, int max_distance, std::vector<uint32_t>& indices) const;
+
+    // Number of differing samples, counted on the packed nibbles.
+    static int distance(const WaveFingerprint& a, const WaveFingerprint& b);
+
+private:
+    static uint32_t block_key(const WaveFingerprint& fingerprint, int block);
+    static size_t slot_of(uint32_t key, size_t mask);
+    void insert(uint32_t key, uint32_t index);
+    void grow();
+
+    std::vector<WaveFingerprint> fingerprints;
+    std::vector<std::string> names;
+    // Open-addressing multimap from (block number, block contents) to entry
+    // index, packed as key << 32 | (index + 1); 0 marks an empty slot. All
+    // entries of one key sit in a single probe run, so a block lookup is
+    // usually one cache line.
+    std::vector<uint64_t> slots;
+    size_t used_slots = 0;
+};
+
+#endif // WAVEFORM_INDEX_H
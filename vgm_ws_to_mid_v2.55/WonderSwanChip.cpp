@@ -1,35 +1,33 @@
 #include "WonderSwanChip.h"
+#include "WonderSwanTables.h"
 #include <algorithm>
-#include <cmath>
 #include <iostream>
-#include <iomanip>
-#include <sstream>
 #include <array>
 
-const double SAMPLES_TO_TICKS = (480.0 * 120.0) / (44100.0 * 60.0);
+std::string ChannelSound::to_string() const {
+    switch (source) {
+        case SoundSource::Wave:  return wave.to_hex();
+        case SoundSource::Noise: return "NOISE_SOUND";
+        case SoundSource::Pcm:   return "PCM_SOUND";
+        default:                 return "PULSE_WAVE";
+    }
+}
 
-WonderSwanChip::WonderSwanChip(MidiWriter& midi_writer, InstrumentConfig& config, UsageLogger& logger, const std::string& source_filename)
+WonderSwanChip::WonderSwanChip(MidiWriter& midi_writer, InstrumentConfig& config, UsageLogger& logger, const std::string& source_filename, const TickClock& tick_clock)
     : midi_writer(midi_writer),
       config(config),
       usage_logger(logger),
       source_filename(source_filename),
       io_ram(0x100, 0),
       internal_ram(0x4000, 0),
-      channel_periods(4, 0),
-      channel_volumes_left(4, 0),
-      channel_volumes_right(4, 0),
-      channel_enabled(4, false),
-      channel_is_active(4, false),
-      channel_last_note(4, 0),
-      channel_last_velocity(4, -1),
-      channel_last_pan(4, -1),
-      channel_instrument(4, -1),
-      channel_is_noise(4, false),
-      channel_last_pitch_bend(4, -1),
-      channel_base_note_freq(4, 0.0),
-      current_sample_time(0),
-      channel_last_tick_time(4, 0) {
-    
+      tick_clock(tick_clock),
+      wave_slot_generation(0x4000 / WAVE_SLOT_SIZE, 0) {
+
+    channels.last_expression.fill(-1);
+    channels.last_pan.fill(-1);
+    channels.instrument.fill(-1);
+    channels.last_pitch_bend.fill(-1);
+    channels.base_period.fill(SILENT_PERIOD);
     sweep_step = 0;
     sweep_time = 0;
     sweep_count = 0;
@@ -44,7 +42,7 @@ WonderSwanChip::WonderSwanChip(MidiWriter& midi_writer, InstrumentConfig& config
         // Set a default instrument (e.g., 80: Square Lead) initially.
         // This will be overridden by the instrument config logic.
         track.add_program_change(0, i, 80); 
-        channel_instrument[i] = 80;
+        channels.instrument[i] = 80;
         track.add_control_change(0, i, 7, 127); // Main Volume
         track.add_control_change(0, i, 11, 127); // Expression
 
@@ -53,187 +51,227 @@ WonderSwanChip::WonderSwanChip(MidiWriter& midi_writer, InstrumentConfig& config
         // Set RPN for pitch bend range (+/- 2 semitones)
         track.add_control_change(0, i, 101, 0); // RPN MSB
         track.add_control_change(0, i, 100, 0); // RPN LSB
-        track.add_control_change(0, i, 6, static_cast<uint8_t>(channel_pitch_bend_range_semitones)); // Data Entry MSB
+        track.add_control_change(0, i, 6, PITCH_BEND_RANGE_CENTS / 100); // Data Entry MSB
         track.add_control_change(0, i, 38, 0); // Data Entry LSB
     }
 }
 
 WonderSwanChip::~WonderSwanChip() {
-    flush_log();
+    if (log_usage) flush_log();
 }
 
 void WonderSwanChip::advance_time(uint16_t samples) {
     process_s_dma(samples);
     process_sweep(samples);
-    for (int i = 0; i < 4; ++i) {
-        check_state_and_update_midi(i);
+    // A channel whose registers and wave RAM are unchanged settles after one
+    // evaluation, so re-checking it would only repeat the same comparisons.
+    if (dirty_channels != 0) {
+        update_channels(dirty_channels);
+        dirty_channels = 0;
     }
-    current_sample_time += samples;
+    tick_clock.advance(samples);
 }
 
-void WonderSwanChip::check_state_and_update_midi(int channel) {
-    uint32_t current_tick = static_cast<uint32_t>(current_sample_time * SAMPLES_TO_TICKS);
-    MidiTrack& track = midi_writer.get_track(channel);
-
-    int target_instrument = -1;
-    std::string waveform_fingerprint = "default";
-
-    // Determine the active sound type for the channel
+int WonderSwanChip::resolve_instrument(int channel, ChannelSound& sound) {
     bool is_pcm = (channel == 1 && (io_ram[0x90] & 0x20) != 0);
     bool is_noise = (channel == 3 && (io_ram[0x90] & 0x80) != 0);
     bool is_wave = !is_pcm && !is_noise && ((io_ram[0x90] & (1 << channel)) != 0);
 
     if (is_pcm) {
-        target_instrument = 119;
-        waveform_fingerprint = "PCM_SOUND";
-    } else if (is_noise) {
-        target_instrument = 127;
-        waveform_fingerprint = "NOISE_SOUND";
-    } else if (is_wave) {
-        uint16_t wave_base_addr = (io_ram[0x8f] << 6) + (channel * 16);
-        std::array<uint8_t, 32> current_waveform_data;
-        for (int i = 0; i < 16; ++i) {
-            uint8_t val = internal_ram[(wave_base_addr + i) & 0x3FFF];
-            current_waveform_data[i * 2] = val & 0x0F;
-            current_waveform_data[i * 2 + 1] = (val >> 4) & 0x0F;
-        }
-        target_instrument = config.find_or_create_instrument(current_waveform_data, source_filename);
-        
-        std::stringstream ss;
-        ss << std::hex << std::setfill('0');
-        for(uint8_t byte : current_waveform_data) {
-            ss << std::setw(2) << static_cast<int>(byte);
-        }
-        waveform_fingerprint = ss.str();
-    } else {
-        target_instrument = 80;
-        waveform_fingerprint = "PULSE_WAVE";
+        sound.source = SoundSource::Pcm;
+        return 119;
     }
-
-    if (target_instrument != -1 && target_instrument != channel_instrument[channel]) {
-        uint32_t delta_time = current_tick - channel_last_tick_time[channel];
-        track.add_program_change(delta_time, channel, target_instrument);
-        channel_instrument[channel] = target_instrument;
-        channel_last_tick_time[channel] = current_tick;
+    if (is_noise) {
+        sound.source = SoundSource::Noise;
+        return 127;
     }
-
-    bool is_active = channel_is_active[channel];
-    bool should_be_on = channel_enabled[channel] && (channel_volumes_left[channel] > 0 || channel_volumes_right[channel] > 0);
-    
-    int current_note_pitch = period_to_midi_note(channel_periods[channel]);
-    if (should_be_on && current_note_pitch == 0) {
-        should_be_on = false;
+    if (!is_wave) {
+        sound.source = SoundSource::Pulse;
+        return 80;
     }
-    
-    if (is_pcm) {
-        current_note_pitch = 60 + (io_ram[0x89] & 0x0F);
-        should_be_on = (io_ram[0x90] & 0x20) != 0 && (pcm_volume_left > 0 || pcm_volume_right > 0);
+    // The wavetable never crosses the end of RAM: (0xFF << 6) + 3 * 16 + 15 == 0x3FFF.
+    uint16_t wave_base_addr = (io_ram[0x8f] << 6) + (channel * 16);
+    int slot = wave_base_addr / WAVE_SLOT_SIZE;
+    WaveCacheEntry& cache = wave_cache[channel];
+    if (cache.slot != slot || cache.generation != wave_slot_generation[slot]) {
+        cache.slot = slot;
+        cache.generation = wave_slot_generation[slot];
+        cache.fingerprint = WaveFingerprint::from_wave_ram(&internal_ram[wave_base_addr]);
+        cache.instrument = config.find_or_create_instrument(cache.fingerprint, source_filename);
     }
+    sound.source = SoundSource::Wave;
+    sound.wave = cache.fingerprint;
+    return cache.instrument;
+}
 
-    uint32_t delta_time = current_tick - channel_last_tick_time[channel];
+uint64_t WonderSwanChip::take_delta_time(int channel) {
+    // Every event of a channel's track passes through here, so this is where
+    // a loop pass records the sample time of each event it emits.
+    if (loop_capturing) {
+        loop_event_samples[channel].push_back(tick_clock.samples());
+    }
+    uint64_t current_tick = tick_clock.ticks();
+    uint64_t delta_time = current_tick - channel_last_tick_time[channel];
+    channel_last_tick_time[channel] = current_tick;
+    return delta_time;
+}
 
-    // --- Note Off Logic ---
-    if (is_active && !should_be_on) {
-        track.add_note_off(delta_time, channel, channel_last_note[channel]);
-        channel_is_active[channel] = false;
-        channel_base_note_freq[channel] = 0.0;
-        channel_last_tick_time[channel] = current_tick;
-        delta_time = 0;
+void WonderSwanChip::update_channels(uint8_t mask) {
+    // Resolving a wavetable may register a new instrument, so it stays a
+    // per-channel step, in channel order.
+    Lanes<int32_t> target_instrument;
+    for (int i = 0; i < CHANNEL_COUNT; ++i) {
+        if (!(mask & (1 << i))) continue;
+        target_instrument[i] = resolve_instrument(i, channel_sound[i]);
     }
 
-    // --- Note On Logic ---
-    if (!is_active && should_be_on) {
-        start_new_note(channel, current_note_pitch, waveform_fingerprint);
+    // Channel 2 plays PCM through its own volume register, and its note
+    // follows the sample value instead of the period.
+    bool pcm = (io_ram[0x90] & 0x20) != 0;
+    auto left = [&](int i) { return pcm && i == 1 ? pcm_volume_left : channels.volume_left[i]; };
+    auto right = [&](int i) { return pcm && i == 1 ? pcm_volume_right : channels.volume_right[i]; };
+
+    // First pass: which notes should sound, giving the note on/off masks.
+    Lanes<int32_t> note;
+    uint8_t audible = 0, program_changed = 0;
+    for (int i = 0; i < CHANNEL_COUNT; ++i) {
+        if (!(mask & (1 << i))) continue;
+        note[i] = PERIOD_PITCH[channels.period[i]].midi_note;
+        audible |= ((left(i) | right(i)) != 0 && note[i] != 0) << i;
+        program_changed |= (target_instrument[i] != -1 && target_instrument[i] != channels.instrument[i]) << i;
     }
-    // --- Continuous Updates (Volume, Pan, Pitch Bend) ---
-    else if (is_active && should_be_on) {
-        bool event_sent = false;
-        
-        // Volume and Pan
-        int left_vol = is_pcm ? pcm_volume_left : channel_volumes_left[channel];
-        int right_vol = is_pcm ? pcm_volume_right : channel_volumes_right[channel];
-        double vgm_vol = std::max(left_vol, right_vol);
-        int expression_vol = static_cast<int>((vgm_vol / 15.0) * 127.0);
-        int pan = 64;
-        int total_vol = left_vol + right_vol;
-        if (total_vol > 0) pan = static_cast<int>((static_cast<double>(right_vol) / total_vol) * 127.0);
-
-        if (expression_vol != channel_last_velocity[channel]) {
-            track.add_control_change(delta_time, channel, 11, expression_vol);
-            channel_last_velocity[channel] = expression_vol;
-            delta_time = 0;
-            event_sent = true;
-        }
-        if (pan != channel_last_pan[channel]) {
-            track.add_control_change(delta_time, channel, 10, pan);
-            channel_last_pan[channel] = pan;
-            delta_time = 0;
-            event_sent = true;
+    uint8_t should_be_on = audible & channels.enabled;
+    if (pcm) {
+        note[1] = 60 + (io_ram[0x89] & 0x0F);
+        should_be_on = (should_be_on & ~0x02) | (((left(1) | right(1)) != 0) << 1);
+    }
+    uint8_t active = channels.active;
+    uint8_t note_off = mask & active & ~should_be_on;
+    uint8_t note_on = mask & ~active & should_be_on;
+    uint8_t sustained = mask & active & should_be_on;
+
+    // Second pass, only for sounding notes: volume, pan and pitch bend targets
+    // and which of them changed.
+    const int64_t bend_range = int64_t(PITCH_BEND_RANGE_CENTS) << CENTS_FRACTION_BITS;
+    Lanes<int32_t> expression, pan, pitch_bend;
+    uint8_t expression_changed = 0, pan_changed = 0, out_of_range = 0, bend_changed = 0;
+    for (int i = 0; i < CHANNEL_COUNT; ++i) {
+        if (!((note_on | sustained) & (1 << i))) continue;
+        const VolumeControls& controls = volume_controls(left(i), right(i));
+        expression[i] = controls.expression;
+        pan[i] = controls.pan;
+        expression_changed |= (expression[i] != channels.last_expression[i]) << i;
+        pan_changed |= (pan[i] != channels.last_pan[i]) << i;
+
+        // Both pitches are fixed-point cents, so the deviation is exact integer maths.
+        int period = channels.period[i];
+        int base_period = channels.base_period[i];
+        if (base_period == SILENT_PERIOD || period == SILENT_PERIOD) continue;
+        int64_t deviation = PERIOD_PITCH[period].cents - PERIOD_PITCH[base_period].cents;
+        if (deviation > bend_range || deviation < -bend_range) {
+            out_of_range |= 1 << i;
+            continue;
         }
+        pitch_bend[i] = std::max(0, std::min(16383, 8192 + static_cast<int>(deviation * 8191 / bend_range)));
+        bend_changed |= (pitch_bend[i] != channels.last_pitch_bend[i]) << i;
+    }
+    // A new note sends its own controls and resets the bend.
+    expression_changed &= sustained;
+    pan_changed &= sustained;
+    out_of_range &= sustained;
+    bend_changed &= sustained;
+
+    // The masks decide which events each channel emits, in the order a
+    // player expects them.
+    uint8_t emitting = program_changed | note_off | note_on | expression_changed | pan_changed | out_of_range | bend_changed;
+    for (int i = 0; i < CHANNEL_COUNT; ++i) {
+        uint8_t bit = 1 << i;
+        if (!(emitting & bit)) continue;
+        MidiTrack& track = midi_writer.get_track(i);
 
-        // Pitch Bend
-        double base_freq = channel_base_note_freq[channel];
-        double current_freq = period_to_freq(channel_periods[channel]);
-        if (base_freq > 0 && current_freq > 0) {
-            double cents_deviation = 1200.0 * log2(current_freq / base_freq);
-
-            if (std::abs(cents_deviation) > channel_pitch_bend_range_semitones * 100.0) {
-                // Deviation is too large, treat as a new note
-                track.add_note_off(delta_time, channel, channel_last_note[channel]);
-                channel_last_tick_time[channel] = current_tick;
-                start_new_note(channel, current_note_pitch, waveform_fingerprint);
-                event_sent = true; // start_new_note updates the time
-            } else {
-                double bend_fraction = cents_deviation / (channel_pitch_bend_range_semitones * 100.0);
-                int pitch_bend_value = 8192 + static_cast<int>(bend_fraction * 8191.0);
-                pitch_bend_value = std::max(0, std::min(16383, pitch_bend_value));
-
-                if (pitch_bend_value != channel_last_pitch_bend[channel]) {
-                    track.add_pitch_bend(delta_time, channel, pitch_bend_value);
-                    channel_last_pitch_bend[channel] = pitch_bend_value;
-                    delta_time = 0;
-                    event_sent = true;
-                }
-            }
+        if (program_changed & bit) {
+            track.add_program_change(take_delta_time(i), i, target_instrument[i]);
+            channels.instrument[i] = target_instrument[i];
         }
-
-        if (event_sent) {
-            channel_last_tick_time[channel] = current_tick;
+        if (note_off & bit) {
+            track.add_note_off(take_delta_time(i), i, channels.last_note[i]);
+            channels.active &= ~bit;
+            channels.base_period[i] = SILENT_PERIOD;
+        }
+        if (note_on & bit) {
+            start_new_note(i, note[i], expression[i], pan[i], channel_sound[i]);
+        }
+        if (expression_changed & bit) {
+            track.add_control_change(take_delta_time(i), i, 11, expression[i]);
+            channels.last_expression[i] = expression[i];
+        }
+        if (pan_changed & bit) {
+            track.add_control_change(take_delta_time(i), i, 10, pan[i]);
+            channels.last_pan[i] = pan[i];
+        }
+        if (out_of_range & bit) {
+            // Deviation is too large, treat as a new note
+            track.add_note_off(take_delta_time(i), i, channels.last_note[i]);
+            start_new_note(i, note[i], expression[i], pan[i], channel_sound[i]);
+        } else if (bend_changed & bit) {
+            track.add_pitch_bend(take_delta_time(i), i, pitch_bend[i]);
+            channels.last_pitch_bend[i] = pitch_bend[i];
         }
     }
 }
 
 void WonderSwanChip::write_ram(uint16_t address, uint8_t value) {
     uint16_t masked_address = address & 0x3FFF;
-    if (masked_address < internal_ram.size()) {
+    if (masked_address < internal_ram.size() && internal_ram[masked_address] != value) {
         internal_ram[masked_address] = value;
+        wave_slot_generation[masked_address / WAVE_SLOT_SIZE]++;
+        mark_ram_write_dirty(masked_address);
+    }
+}
+
+void WonderSwanChip::mark_ram_write_dirty(uint16_t address) {
+    // The four 16-byte wavetables start at (0x8F << 6); writes elsewhere are not audible.
+    uint16_t wave_base_addr = io_ram[0x8f] << 6;
+    if (address >= wave_base_addr && address < wave_base_addr + 64) {
+        dirty_channels |= 1 << ((address - wave_base_addr) >> 4);
     }
 }
 
 void WonderSwanChip::write_port(uint8_t port, uint8_t value) {
+    bool changed = io_ram[port] != value;
     io_ram[port] = value;
     uint16_t period;
+
+    // Registers read by update_channels(). Like wave RAM, rewriting a register
+    // with the value it already holds cannot change what a channel plays.
+    if (changed) {
+        if (port >= 0x80 && port <= 0x87) dirty_channels |= 1 << ((port - 0x80) >> 1);
+        else if (port >= 0x88 && port <= 0x8B) dirty_channels |= 1 << (port - 0x88);
+        else if (port == 0x8F || port == 0x90) dirty_channels = 0x0F;
+        else if (port == 0x94) dirty_channels |= 1 << 1; // PCM volume (channel 2)
+    }
+
     switch (port) {
         case 0x80: case 0x81: 
             period = ((io_ram[0x81] & 0x07) << 8) | io_ram[0x80];
-            channel_periods[0] = (period == 0x7FF) ? 2048 : period;
+            channels.period[0] = (period == 0x7FF) ? SILENT_PERIOD : period;
             break;
         case 0x82: case 0x83: 
             period = ((io_ram[0x83] & 0x07) << 8) | io_ram[0x82];
-            channel_periods[1] = (period == 0x7FF) ? 2048 : period;
+            channels.period[1] = (period == 0x7FF) ? SILENT_PERIOD : period;
             break;
         case 0x84: case 0x85: 
             period = ((io_ram[0x85] & 0x07) << 8) | io_ram[0x84];
-            channel_periods[2] = (period == 0x7FF) ? 2048 : period;
+            channels.period[2] = (period == 0x7FF) ? SILENT_PERIOD : period;
             break;
         case 0x86: case 0x87: 
             period = ((io_ram[0x87] & 0x07) << 8) | io_ram[0x86];
-            channel_periods[3] = (period == 0x7FF) ? 2048 : period;
+            channels.period[3] = (period == 0x7FF) ? SILENT_PERIOD : period;
             break;
-        case 0x88: channel_volumes_left[0] = (io_ram[0x88] >> 4) & 0x0F; channel_volumes_right[0] = io_ram[0x88] & 0x0F; break;
-        case 0x89: channel_volumes_left[1] = (io_ram[0x89] >> 4) & 0x0F; channel_volumes_right[1] = io_ram[0x89] & 0x0F; break;
-        case 0x8A: channel_volumes_left[2] = (io_ram[0x8A] >> 4) & 0x0F; channel_volumes_right[2] = io_ram[0x8A] & 0x0F; break;
-        case 0x8B: channel_volumes_left[3] = (io_ram[0x8B] >> 4) & 0x0F; channel_volumes_right[3] = io_ram[0x8B] & 0x0F; break;
+        case 0x88: channels.volume_left[0] = (io_ram[0x88] >> 4) & 0x0F; channels.volume_right[0] = io_ram[0x88] & 0x0F; break;
+        case 0x89: channels.volume_left[1] = (io_ram[0x89] >> 4) & 0x0F; channels.volume_right[1] = io_ram[0x89] & 0x0F; break;
+        case 0x8A: channels.volume_left[2] = (io_ram[0x8A] >> 4) & 0x0F; channels.volume_right[2] = io_ram[0x8A] & 0x0F; break;
+        case 0x8B: channels.volume_left[3] = (io_ram[0x8B] >> 4) & 0x0F; channels.volume_right[3] = io_ram[0x8B] & 0x0F; break;
         case 0x8C: sweep_step = static_cast<int8_t>(value); break;
         case 0x8D:
         {
@@ -250,7 +288,7 @@ void WonderSwanChip::write_port(uint8_t port, uint8_t value) {
             if (value & 0x08) noise_reset = true;
             break;
         case 0x90:
-            for (int i = 0; i < 4; ++i) channel_enabled[i] = (value & (1 << i)) != 0;
+            channels.enabled = value & 0x0F;
             break;
         case 0x91:
             io_ram[0x91] |= 0x80;
@@ -304,87 +342,164 @@ void WonderSwanChip::process_sweep(uint32_t samples) {
             if (sweep_time > 0) sweep_count += sweep_time;
             else break;
             
-            uint16_t current_period = channel_periods[2];
+            uint16_t current_period = channels.period[2];
             current_period += sweep_step;
             current_period &= 0x7FF;
             
             io_ram[0x84] = current_period & 0xFF;
             io_ram[0x85] = (io_ram[0x85] & 0xF8) | ((current_period >> 8) & 0x07);
-            channel_periods[2] = current_period;
+            channels.period[2] = current_period;
+            dirty_channels |= 1 << 2;
         }
     }
 }
 
 void WonderSwanChip::finalize() {
-    uint32_t final_tick = static_cast<uint32_t>(current_sample_time * SAMPLES_TO_TICKS);
+    uint64_t final_tick = tick_clock.ticks();
+    for (int i = 0; i < CHANNEL_COUNT; ++i) {
+        if (channels.active & (1 << i)) {
+            midi_writer.get_track(i).add_note_off(final_tick - channel_last_tick_time[i], i, channels.last_note[i]);
+        }
+    }
+}
+
+bool WonderSwanChip::ChannelState::operator==(const ChannelState& o) const {
+    return period == o.period && volume_left == o.volume_left && volume_right == o.volume_right &&
+           last_note == o.last_note && last_expression == o.last_expression && last_pan == o.last_pan &&
+           instrument == o.instrument && last_pitch_bend == o.last_pitch_bend && base_period == o.base_period &&
+           enabled == o.enabled && active == o.active;
+}
+
+bool WonderSwanChip::LoopState::operator==(const LoopState& o) const {
+    return io_ram == o.io_ram && internal_ram == o.internal_ram &&
+           channels == o.channels && dirty_channels == o.dirty_channels &&
+           s_dma_source_addr == o.s_dma_source_addr && s_dma_timer == o.s_dma_timer &&
+           s_dma_period == o.s_dma_period && s_dma_count == o.s_dma_count &&
+           sweep_step == o.sweep_step && sweep_time == o.sweep_time && sweep_count == o.sweep_count &&
+           noise_type == o.noise_type && noise_reset == o.noise_reset &&
+           pcm_volume_left == o.pcm_volume_left && pcm_volume_right == o.pcm_volume_right;
+}
+
+WonderSwanChip::LoopState WonderSwanChip::capture_state() const {
+    return LoopState{io_ram, internal_ram, channels, dirty_channels, s_dma_source_addr, s_dma_timer, s_dma_period, s_dma_count,
+                     sweep_step, sweep_time, sweep_count, noise_type, noise_reset,
+                     pcm_volume_left, pcm_volume_right};
+}
+
+void WonderSwanChip::begin_loop_capture() {
+    loop_capturing = true;
+    loop_start_state = capture_state();
+    loop_start_sample = tick_clock.samples();
+    loop_start_usage = usage_data;
+    for (int i = 0; i < 4; ++i) {
+        loop_first_event[i] = midi_writer.get_track(i).get_event_count();
+        loop_event_samples[i].clear();
+    }
+}
+
+bool WonderSwanChip::end_loop_capture() {
+    if (!loop_capturing) return false;
+    loop_capturing = false;
+    // Replay needs a sample time for every event of the pass; an event added
+    // without take_delta_time() would shift all later ones, so emulate instead.
     for (int i = 0; i < 4; ++i) {
-        if (channel_is_active[i]) {
-            uint32_t delta_time = final_tick - channel_last_tick_time[i];
-            midi_writer.get_track(i).add_note_off(delta_time, i, channel_last_note[i]);
+        if (loop_event_samples[i].size() != midi_writer.get_track(i).get_event_count() - loop_first_event[i]) {
+            return false;
         }
     }
+    return tick_clock.samples() > loop_start_sample && capture_state() == loop_start_state;
 }
 
-void WonderSwanChip::flush_log() {
-    usage_logger.write_log(source_filename, config, usage_data);
+void WonderSwanChip::replay_loop(int passes) {
+    uint64_t loop_samples = tick_clock.samples() - loop_start_sample;
+    for (int i = 0; i < 4; ++i) {
+        const std::vector<uint64_t>& samples = loop_event_samples[i];
+        if (samples.empty()) continue;
+        MidiTrack& track = midi_writer.get_track(i);
+        std::vector<uint64_t> times(samples.size());
+        for (int pass = 1; pass <= passes; ++pass) {
+            // Map every event's own sample time, so rounding matches a full emulation.
+            for (size_t k = 0; k < samples.size(); ++k) {
+                times[k] = tick_clock.ticks_at(samples[k] + pass * loop_samples);
+            }
+            track.repeat_events(loop_first_event[i], loop_first_event[i] + samples.size(), times);
+        }
+        channel_last_tick_time[i] = tick_clock.ticks_at(samples.back() + passes * loop_samples);
+    }
+
+    // Each pass starts the same notes again.
+    for (auto& channel_pair : usage_data) {
+        for (auto& sound_pair : channel_pair.second) {
+            int before = 0;
+            auto channel_it = loop_start_usage.find(channel_pair.first);
+            if (channel_it != loop_start_usage.end()) {
+                auto sound_it = channel_it->second.find(sound_pair.first);
+                if (sound_it != channel_it->second.end()) before = sound_it->second;
+            }
+            sound_pair.second += (sound_pair.second - before) * passes;
+        }
+    }
+    tick_clock.advance(loop_samples * passes);
 }
 
-size_t WonderSwanChip::get_channel_count() const {
-    return channel_periods.size();
+void WonderSwanChip::add_marker(const std::string& text) {
+    // Track 0 also carries channel 0, so keep its delta-time bookkeeping in step.
+    MidiTrack& track = midi_writer.get_track(0);
+    track.add_meta_event(take_delta_time(0), 0x06, std::vector<uint8_t>(text.begin(), text.end()));
 }
 
-const std::map<int, std::map<std::string, int>>& WonderSwanChip::get_usage_data() const {
-    return usage_data;
+void WonderSwanChip::mark_loop_start() {
+    add_marker("loopStart");
+    midi_writer.get_track(0).add_control_change(take_delta_time(0), 0, 111, 0);
+    loop_start_marked = true;
 }
 
-double WonderSwanChip::period_to_freq(int period) {
-    if (period >= 2048) return 0.0;
-    return (3072000.0 / (2048.0 - period)) / 32.0;
+void WonderSwanChip::mark_loop_end() {
+    if (!loop_start_marked) return;
+    add_marker("loopEnd");
 }
 
-int WonderSwanChip::period_to_midi_note(int period) {
-    double freq = period_to_freq(period);
-    if (freq <= 0) return 0;
-    int note = static_cast<int>(round(69 + 12 * log2(freq / 440.0)));
-    return note > 127 ? 127 : note;
+void WonderSwanChip::flush_log() {
+    // The log is written once per file, so only now are fingerprints turned into text.
+    std::map<int, std::map<std::string, int>> usage_by_name;
+    for (const auto& channel_pair : usage_data) {
+        auto& names = usage_by_name[channel_pair.first];
+        for (const auto& sound_pair : channel_pair.second) {
+            names[sound_pair.first.to_string()] += sound_pair.second;
+        }
+    }
+    usage_logger.write_log(source_filename, config, usage_by_name);
 }
 
-void WonderSwanChip::start_new_note(int channel, int note_pitch, const std::string& waveform_fingerprint) {
-    uint32_t current_tick = static_cast<uint32_t>(current_sample_time * SAMPLES_TO_TICKS);
-    uint32_t delta_time = current_tick - channel_last_tick_time[channel];
+size_t WonderSwanChip::get_channel_count() const {
+    return CHANNEL_COUNT;
+}
+
+const std::map<int, std::map<ChannelSound, int>>& WonderSwanChip::get_usage_data() const {
+    return usage_data;
+}
+
+void WonderSwanChip::start_new_note(int channel, int note_pitch, int expression, int pan, const ChannelSound& sound) {
     MidiTrack& track = midi_writer.get_track(channel);
 
-    usage_data[channel][waveform_fingerprint]++;
+    usage_data[channel][sound]++;
 
-    bool is_pcm = (channel == 1 && (io_ram[0x90] & 0x20) != 0);
-    int left_vol = is_pcm ? pcm_volume_left : channel_volumes_left[channel];
-    int right_vol = is_pcm ? pcm_volume_right : channel_volumes_right[channel];
-    double vgm_vol = std::max(left_vol, right_vol);
-    int expression_vol = static_cast<int>((vgm_vol / 15.0) * 127.0);
-    int pan = 64;
-    int total_vol = left_vol + right_vol;
-    if (total_vol > 0) pan = static_cast<int>((static_cast<double>(right_vol) / total_vol) * 127.0);
-
-    if (pan != channel_last_pan[channel]) {
-        track.add_control_change(delta_time, channel, 10, pan);
-        delta_time = 0;
+    if (pan != channels.last_pan[channel]) {
+        track.add_control_change(take_delta_time(channel), channel, 10, pan);
     }
-    if (expression_vol != channel_last_velocity[channel]) {
-        track.add_control_change(delta_time, channel, 11, expression_vol);
-        delta_time = 0;
+    if (expression != channels.last_expression[channel]) {
+        track.add_control_change(take_delta_time(channel), channel, 11, expression);
     }
     
-    if (channel_last_pitch_bend[channel] != 8192) {
-        track.add_pitch_bend(delta_time, channel, 8192);
-        channel_last_pitch_bend[channel] = 8192;
-        delta_time = 0;
+    if (channels.last_pitch_bend[channel] != 8192) {
+        track.add_pitch_bend(take_delta_time(channel), channel, 8192);
+        channels.last_pitch_bend[channel] = 8192;
     }
 
-    track.add_note_on(delta_time, channel, note_pitch, 127);
-    channel_is_active[channel] = true;
-    channel_last_note[channel] = note_pitch;
-    channel_base_note_freq[channel] = period_to_freq(channel_periods[channel]);
-    channel_last_velocity[channel] = expression_vol;
-    channel_last_pan[channel] = pan;
-    channel_last_tick_time[channel] = current_tick;
+    track.add_note_on(take_delta_time(channel), channel, note_pitch, 127);
+    channels.active |= 1 << channel;
+    channels.last_note[channel] = note_pitch;
+    channels.base_period[channel] = channels.period[channel];
+    channels.last_expression[channel] = expression;
+    channels.last_pan[channel] = pan;
 }
@@ -4,15 +4,33 @@
 #include "MidiWriter.h"
 #include "InstrumentConfig.h"
 #include "UsageLogger.h" // Include UsageLogger
+#include "TickClock.h"
 #include <string>
 #include <cstdint>
 #include <vector>
 #include <fstream>
 #include <map>
+#include <array>
+
+// What a channel is playing, as recorded in the usage log. Enumerators are
+// ordered like the log's text labels so the log lists them in the same order.
+enum class SoundSource : uint8_t { Wave, Noise, Pcm, Pulse };
+
+struct ChannelSound {
+    SoundSource source = SoundSource::Pulse;
+    WaveFingerprint wave; // Only meaningful for SoundSource::Wave
+
+    std::string to_string() const;
+    bool operator<(const ChannelSound& other) const {
+        if (source != other.source) return source < other.source;
+        return wave < other.wave;
+    }
+};
 
 class WonderSwanChip {
 public:
-    WonderSwanChip(MidiWriter& midi_writer, InstrumentConfig& config, UsageLogger& logger, const std::string& source_filename);
+    WonderSwanChip(MidiWriter& midi_writer, InstrumentConfig& config, UsageLogger& logger, const std::string& source_filename,
+                   const TickClock& tick_clock = TickClock());
     ~WonderSwanChip();
     void write_port(uint8_t port, uint8_t value);
     void write_ram(uint16_t address, uint8_t value);
@@ -20,33 +38,66 @@ public:
     void finalize();
     void flush_log();
     size_t get_channel_count() const;
-    const std::map<int, std::map<std::string, int>>& get_usage_data() const;
+
+    // Loop replay. begin_loop_capture() marks the start of a loop pass.
+    // end_loop_capture() returns true if the pass ended in the state it
+    // started in; every further pass would then emit the same events, so
+    // replay_loop() copies them `passes` more times instead of emulating.
+    // Needs the tracks to store their events (no sink).
+    void begin_loop_capture();
+    bool end_loop_capture();
+    void replay_loop(int passes);
+    // Loop points for players that loop natively: mark_loop_start() writes
+    // CC111 and a "loopStart" marker, mark_loop_end() a "loopEnd" marker, both
+    // on the first track at the current time. mark_loop_end() does nothing
+    // if no loop start was marked.
+    void mark_loop_start();
+    void mark_loop_end();
+    // Keeps this chip out of the usage log, e.g. for a second, verifying run.
+    void disable_usage_log() { log_usage = false; }
+    const std::map<int, std::map<ChannelSound, int>>& get_usage_data() const;
 
 private:
-    std::map<int, std::map<std::string, int>> usage_data;
+    std::map<int, std::map<ChannelSound, int>> usage_data;
     MidiWriter& midi_writer;
     InstrumentConfig& config;
     UsageLogger& usage_logger;
     std::string source_filename;
     std::vector<uint8_t> io_ram;
     std::vector<uint8_t> internal_ram;
-    std::vector<int> channel_periods;
-    std::vector<int> channel_volumes_left;
-    std::vector<int> channel_volumes_right;
-    std::vector<bool> channel_enabled;
-    std::vector<bool> channel_is_active; // New state to track if a note is currently playing
-    std::vector<int> channel_last_note;
-    std::vector<int> channel_last_velocity; // For volume dynamics
-    std::vector<int> channel_last_pan;      // For stereo panning
-    std::vector<int> channel_instrument;
-    std::vector<bool> channel_is_noise;
-    std::vector<int> channel_last_pitch_bend;
-    std::vector<double> channel_base_note_freq;
-    const double channel_pitch_bend_range_semitones = 2.0;
-    uint64_t current_sample_time; // Using uint64_t to prevent overflow with large files
-    std::vector<uint32_t> channel_last_tick_time; // To calculate delta-times for each track
+
+    // Per-channel state as one fixed array per field, indexed by channel (a
+    // "lane"). update_channels() computes each target across the dirty lanes
+    // and collects per-event change masks. Flags are masks, bit n = channel n.
+    static constexpr int CHANNEL_COUNT = 4;
+    template <typename T>
+    using Lanes = std::array<T, CHANNEL_COUNT>;
+    struct alignas(16) ChannelState {
+        Lanes<int32_t> period{};          // SILENT_PERIOD when 0x7FF is written
+        Lanes<int32_t> volume_left{};
+        Lanes<int32_t> volume_right{};
+        Lanes<int32_t> last_note{};
+        Lanes<int32_t> last_expression{}; // Last CC11 sent, -1 before the first
+        Lanes<int32_t> last_pan{};        // Last CC10 sent, -1 before the first
+        Lanes<int32_t> instrument{};      // Last program sent, -1 before the first
+        Lanes<int32_t> last_pitch_bend{};
+        Lanes<int32_t> base_period{};     // Period the sounding note started at, SILENT_PERIOD if none
+        uint8_t enabled = 0;
+        uint8_t active = 0;               // A note is sounding
+
+        bool operator==(const ChannelState& other) const;
+    };
+    ChannelState channels;
+    Lanes<ChannelSound> channel_sound; // What each channel plays, as of its last update
+    static constexpr int PITCH_BEND_RANGE_CENTS = 200;
+    TickClock tick_clock; // Sample time and the matching MIDI tick, both 64-bit
+    Lanes<uint64_t> channel_last_tick_time{}; // To calculate delta-times for each track
     std::ofstream log_file;
 
+    // Bit n set = channel n's inputs changed since it was last evaluated.
+    // Only dirty channels are re-evaluated on a wait; the rest cannot produce events.
+    uint8_t dirty_channels = 0x0F;
+
     // Sound DMA state
     uint32_t s_dma_source_addr = 0;
     uint16_t s_dma_count = 0;
@@ -66,13 +117,55 @@ private:
     int pcm_volume_left = 0;
     int pcm_volume_right = 0;
 
+    // Wavetable cache. Every 16-byte slot of sound RAM has a generation that
+    // write_ram() bumps; a channel only re-packs its wavetable and resolves
+    // the instrument when its slot (via 0x8F) or that slot's generation changes.
+    static constexpr size_t WAVE_SLOT_SIZE = 16;
+    struct WaveCacheEntry {
+        int slot = -1;
+        uint32_t generation = 0;
+        WaveFingerprint fingerprint;
+        int instrument = -1;
+    };
+    std::vector<uint32_t> wave_slot_generation;
+    WaveCacheEntry wave_cache[4];
+
+    // Everything that decides which events are emitted next, apart from the
+    // time. The wavetable cache is left out: it only mirrors sound RAM.
+    struct LoopState {
+        std::vector<uint8_t> io_ram, internal_ram;
+        ChannelState channels;
+        uint8_t dirty_channels;
+        uint32_t s_dma_source_addr, s_dma_timer, s_dma_period;
+        uint16_t s_dma_count;
+        int8_t sweep_step;
+        int16_t sweep_time, sweep_count;
+        uint8_t noise_type;
+        bool noise_reset;
+        int pcm_volume_left, pcm_volume_right;
+
+        bool operator==(const LoopState& other) const;
+    };
+    LoopState capture_state() const;
+
+    bool loop_capturing = false;
+    LoopState loop_start_state;
+    uint64_t loop_start_sample = 0;
+    std::map<int, std::map<ChannelSound, int>> loop_start_usage;
+    size_t loop_first_event[4] = {};
+    std::vector<uint64_t> loop_event_samples[4]; // Sample time of each event emitted in the pass
+    bool log_usage = true;
+    bool loop_start_marked = false;
+
     // Custom waveform detection
     std::map<std::string, std::vector<uint8_t>> discovered_waveforms;
 
-    double period_to_freq(int period);
-    int period_to_midi_note(int period);
-    void check_state_and_update_midi(int channel);
-    void start_new_note(int channel, int note_pitch, const std::string& waveform_fingerprint);
+    void update_channels(uint8_t mask);
+    int resolve_instrument(int channel, ChannelSound& sound);
+    uint64_t take_delta_time(int channel);
+    void mark_ram_write_dirty(uint16_t address);
+    void add_marker(const std::string& text);
+    void start_new_note(int channel, int note_pitch, int expression, int pan, const ChannelSound& sound);
     void process_s_dma(uint32_t samples);
     void process_sweep(uint32_t samples);
     bool are_waveforms_similar(const std::vector<uint8_t>& w1, const std::vector<uint8_t>& w2);
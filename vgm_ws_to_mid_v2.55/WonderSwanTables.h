@@ -0,0 +1,80 @@
+#ifndef WONDERSWAN_TABLES_H
+#define WONDERSWAN_TABLES_H
+
+#include <array>
+#include <cstdint>
+
+// Compile-time tables for the MIDI values derived from the sound registers.
+// They only use basic double arithmetic, which constant evaluation rounds
+// exactly, so unlike log2() from the C library they come out the same with
+// every compiler.
+
+// Frequency registers are 11 bits. Writing 0x7FF mutes the channel, which
+// the chip stores as SILENT_PERIOD.
+constexpr int SILENT_PERIOD = 2048;
+// Fractional bits of PeriodPitch::cents.
+constexpr int CENTS_FRACTION_BITS = 32;
+
+struct PeriodPitch {
+    int64_t cents = 0;     // Pitch relative to A4 (440 Hz), fixed point
+    uint8_t midi_note = 0; // Nearest MIDI note, at most 127; 0 when silent
+};
+
+struct VolumeControls {
+    uint8_t expression = 0; // CC11, from the louder side
+    uint8_t pan = 0;        // CC10, from the balance between the sides
+};
+
+// Natural logarithm of x > 0. x is scaled to m * 2^e with m in [1, 2), where
+// ln(m) = 2 * atanh((m - 1) / (m + 1)) and the series converges quickly.
+constexpr double constexpr_ln(double x) {
+    const double ln2 = 0.693147180559945309417232121458176568;
+    int exponent = 0;
+    while (x >= 2.0) { x /= 2.0; ++exponent; }
+    while (x < 1.0) { x *= 2.0; --exponent; }
+    double s = (x - 1.0) / (x + 1.0);
+    double term = s, sum = 0.0;
+    for (int k = 1; k < 80; k += 2) {
+        sum += term / k;
+        term *= s * s;
+    }
+    return 2.0 * sum + exponent * ln2;
+}
+
+constexpr std::array<PeriodPitch, SILENT_PERIOD + 1> make_period_pitch_table() {
+    const double ln2 = 0.693147180559945309417232121458176568;
+    std::array<PeriodPitch, SILENT_PERIOD + 1> table{};
+    for (int period = 0; period < SILENT_PERIOD; ++period) {
+        double freq = (3072000.0 / (2048.0 - period)) / 32.0;
+        double cents = 1200.0 * (constexpr_ln(freq / 440.0) / ln2);
+        double fixed = cents * static_cast<double>(int64_t(1) << CENTS_FRACTION_BITS);
+        table[period].cents = static_cast<int64_t>(fixed < 0 ? fixed - 0.5 : fixed + 0.5);
+        // The lowest period is about MIDI note 30, so the note is positive.
+        int note = static_cast<int>(69.0 + cents / 100.0 + 0.5);
+        table[period].midi_note = static_cast<uint8_t>(note > 127 ? 127 : note);
+    }
+    return table;
+}
+
+// Indexed by (left << 4) | right, each a 4-bit volume.
+constexpr std::array<VolumeControls, 256> make_volume_controls_table() {
+    std::array<VolumeControls, 256> table{};
+    for (int left = 0; left < 16; ++left) {
+        for (int right = 0; right < 16; ++right) {
+            VolumeControls& controls = table[(left << 4) | right];
+            int loudest = left > right ? left : right;
+            controls.expression = static_cast<uint8_t>(loudest * 127 / 15);
+            controls.pan = static_cast<uint8_t>(left + right > 0 ? right * 127 / (left + right) : 64);
+        }
+    }
+    return table;
+}
+
+inline constexpr std::array<PeriodPitch, SILENT_PERIOD + 1> PERIOD_PITCH = make_period_pitch_table();
+inline constexpr std::array<VolumeControls, 256> VOLUME_CONTROLS = make_volume_controls_table();
+
+inline const VolumeControls& volume_controls(int left, int right) {
+    return VOLUME_CONTROLS[(left << 4) | right];
+}
+
+#endif // WONDERSWAN_TABLES_H
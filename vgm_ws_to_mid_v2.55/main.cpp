@@ -2,114 +2,253 @@
 #include <vector>
 #include <string>
 #include <filesystem>
+#include <algorithm>
+#include <sstream>
+#include <mutex>
+#include <thread>
+#include <cmath>
 #include "MidiWriter.h"
+#include "SmfStreamWriter.h"
 #include "WonderSwanChip.h"
 #include "VgmReader.h"
+#include "VgmStreamReader.h"
+#include "VgmCommand.h"
+#include "VgmCommandStream.h"
 #include "InstrumentConfig.h"
 #include "UsageLogger.h"
+#include "ThreadPool.h"
+#include "TickClock.h"
 
 // Recompile trigger
 namespace fs = std::filesystem;
 
-void convert_file(const std::string& input_filename, const std::string& output_filename, int num_loops, InstrumentConfig& config, UsageLogger& logger) {
-    std::cout << "\n--- Converting: " << input_filename << " -> " << output_filename << " ---" << std::endl;
+struct ConversionOptions {
+    int num_loops = 2;
+    bool stream_input = false; // Decode through VgmStreamReader instead of loading the whole file
+    bool realtime_output = false; // Write a Format 0 stream while converting instead of a file at the end
+    uint16_t midi_format = 1;     // SMF format of the file written at the end (0 or 1)
+    bool optimize_output = false; // Drop redundant controller/pitch-bend events before writing
+    DecimationSettings decimation; // Thin out pitch bend/controller curves before writing
+    bool loop_replay = false;     // Copy the events of a repeating loop pass instead of emulating it again
+    bool verify_loop = false;     // Check loop replay against a full emulation
+    bool loop_markers = false;    // Write the loop body once, between loop markers
+    uint16_t ticks_per_quarter_note = 480;
+    uint32_t tempo_us = 500000;   // Microseconds per quarter note (120 BPM)
+};
 
-    MidiWriter midi_writer(480);
-    size_t meta_track_idx = midi_writer.add_track();
-    MidiTrack& meta_track = midi_writer.get_track(meta_track_idx);
-    meta_track.add_tempo_change(0, 500000);
+static void apply_command(WonderSwanChip& chip, const VgmCommand& command) {
+    switch (command.type) {
+        case VgmCommandType::Wait:
+            chip.advance_time(static_cast<uint16_t>(command.wait_samples));
+            break;
+        case VgmCommandType::PortWrite:
+            chip.write_port(static_cast<uint8_t>(command.address), command.value);
+            break;
+        case VgmCommandType::RamWrite:
+            chip.write_ram(command.address, command.value);
+            break;
+        default:
+            break; // Commands for other chips, data blocks, etc.
+    }
+}
 
-    WonderSwanChip chip(midi_writer, config, logger, input_filename);
-    VgmReader reader(chip);
+// The input of one conversion. It is opened and parsed before any output is
+// touched, so a missing or broken file never truncates an existing .mid.
+struct VgmInput {
+    VgmCommandStream commands; // Decoded up front unless --stream
+    VgmStreamReader stream;    // Read through a ring buffer with --stream
+};
 
+static bool open_input(const std::string& input_filename, const ConversionOptions& options, VgmInput& input) {
+    if (options.stream_input) {
+        return input.stream.open(input_filename);
+    }
+    VgmReader reader;
     if (!reader.load_and_parse(input_filename)) {
-        std::cerr << "Failed to load or parse VGM file: " << input_filename << std::endl;
-        return;
+        return false;
     }
+    input.commands.decode(reader.get_data(), reader.get_data_offset(), reader.get_loop_offset());
+    return true;
+}
 
-    const auto& data = reader.get_data();
-    uint32_t loop_offset = reader.get_loop_offset();
-    uint32_t current_pos = reader.get_data_offset();
-    uint32_t end_pos = data.size();
-
+// Drives the chip from the decoded VgmCommandStream; loops are replayed by
+// index instead of re-parsing bytes. Returns true if the remaining loop
+// passes were copied by loop replay instead of being emulated.
+static bool run_in_memory(const VgmCommandStream& commands, WonderSwanChip& chip, const ConversionOptions& options) {
     int loops_done = 0;
+    size_t index = 0;
+    size_t count = commands.size();
+    bool capture_loops = options.loop_replay && commands.has_loop();
 
-    while (current_pos < end_pos) {
-        uint8_t command_byte = data[current_pos];
-
-        if (command_byte == 0x66) {
-            if (loop_offset != 0 && loops_done < num_loops) {
-                loops_done++;
-                current_pos = loop_offset;
-                continue;
-            } else {
-                break;
-            }
+    while (index < count) {
+        if (commands.has_loop() && index == commands.get_loop_index()) {
+            if (capture_loops) chip.begin_loop_capture();
+            if (options.loop_markers && loops_done == 0) chip.mark_loop_start();
         }
-
-        switch (command_byte) {
-            case 0x61: {
-                if (current_pos + 2 >= end_pos) { current_pos = end_pos; continue; }
-                uint16_t wait = *reinterpret_cast<const uint16_t*>(&data[current_pos + 1]);
-                chip.advance_time(wait);
-                current_pos += 3;
-                break;
-            }
-            case 0x62:
-                chip.advance_time(735);
-                current_pos += 1;
-                break;
-            case 0x63:
-                chip.advance_time(882);
-                current_pos += 1;
-                break;
-            case 0x70: case 0x71: case 0x72: case 0x73: case 0x74: case 0x75:
-            case 0x76: case 0x77: case 0x78: case 0x79: case 0x7a: case 0x7b:
-            case 0x7c: case 0x7d: case 0x7e: case 0x7f:
-                chip.advance_time((command_byte & 0x0F) + 1);
-                current_pos += 1;
-                break;
-            case 0xb3: // GameBoy DMG, should be ignored
-                current_pos += 3;
-                break;
-            case 0xbc: {
-                if (current_pos + 2 >= end_pos) { current_pos = end_pos; continue; }
-                uint8_t port = 0x80 + data[current_pos + 1];
-                uint8_t value = data[current_pos + 2];
-                chip.write_port(port, value);
-                current_pos += 3;
-                break;
-            }
-            case 0xc6: {
-                if (current_pos + 3 >= end_pos) { current_pos = end_pos; continue; }
-                uint16_t address = (data[current_pos + 1] << 8) | data[current_pos + 2];
-                uint8_t value = data[current_pos + 3];
-                chip.write_ram(address, value);
-                current_pos += 4;
+        switch (commands.type(index)) {
+            case VgmCommandType::Wait:
+                chip.advance_time(static_cast<uint16_t>(commands.wait_samples(index)));
                 break;
-            }
-            case 0x4f:
-            case 0x50:
-                current_pos += 2;
-                break;
-            case 0x51: case 0x52: case 0x53: case 0x54: case 0x55: case 0x56: case 0x57: case 0x58:
-            case 0x59: case 0x5a: case 0x5b: case 0x5c: case 0x5d: case 0x5e: case 0x5f:
-                current_pos += 3;
+            case VgmCommandType::PortWrite:
+                chip.write_port(static_cast<uint8_t>(commands.address(index)), commands.value(index));
                 break;
-            case 0x67: {
-                if (current_pos + 6 >= end_pos) { current_pos = end_pos; continue; }
-                current_pos += 6 + (*reinterpret_cast<const uint32_t*>(&data[current_pos + 2]));
+            case VgmCommandType::RamWrite:
+                chip.write_ram(commands.address(index), commands.value(index));
                 break;
-            }
+            case VgmCommandType::End:
+                if (commands.has_loop() && loops_done < options.num_loops) {
+                    if (capture_loops && chip.end_loop_capture()) {
+                        chip.replay_loop(options.num_loops - loops_done);
+                        return true;
+                    }
+                    loops_done++;
+                    index = commands.get_loop_index();
+                    continue;
+                }
+                return false;
             default:
-                current_pos++;
                 break;
         }
+        index++;
     }
+    return false;
+}
+
+// Runs the command loop through a fixed-size ring buffer; memory use is
+// independent of the input length and .vgz files are decompressed on the fly.
+// Returns true if loop replay was used, as run_in_memory().
+static bool run_streaming(VgmStreamReader& reader, WonderSwanChip& chip, const ConversionOptions& options) {
+    uint32_t loop_offset = reader.get_loop_offset();
+    // As in VgmCommandStream::decode(), the loop starts at the first command at
+    // or after the loop offset, which need not fall on a command boundary.
+    // A loop offset past the end marker is never reached and means no loop.
+    bool has_loop = false;
+    uint64_t loop_position = 0;
+    int loops_done = 0;
+    VgmCommand command;
+    bool capture_loops = options.loop_replay && loop_offset != 0;
 
+    while (true) {
+        uint64_t position = reader.get_position();
+        if (!has_loop && loop_offset != 0 && position >= loop_offset) {
+            has_loop = true;
+            loop_position = position;
+        }
+        if (has_loop && position == loop_position) {
+            if (capture_loops) chip.begin_loop_capture();
+            if (options.loop_markers && loops_done == 0) chip.mark_loop_start();
+        }
+        if (!reader.next_command(command)) break;
+        if (command.type == VgmCommandType::End) {
+            if (has_loop && loops_done < options.num_loops) {
+                if (capture_loops && chip.end_loop_capture()) {
+                    chip.replay_loop(options.num_loops - loops_done);
+                    return true;
+                }
+                loops_done++;
+                if (!reader.seek(loop_position)) break;
+                continue;
+            }
+            break;
+        }
+        apply_command(chip, command);
+    }
+    return false;
+}
+
+static bool run_input(VgmInput& input, WonderSwanChip& chip, const ConversionOptions& options) {
+    return options.stream_input ? run_streaming(input.stream, chip, options)
+                                : run_in_memory(input.commands, chip, options);
+}
+
+// Converts the file again with every loop pass emulated and compares the
+// result with `replayed`. On a mismatch the emulated tracks replace it.
+// If the first run copied no loop pass (`used_replay` is false) it already
+// was a full emulation, so there is nothing to compare.
+static void verify_loop_replay(const std::string& input_filename, MidiWriter& replayed, bool used_replay, const ConversionOptions& options, InstrumentConfig& config, UsageLogger& logger, std::ostream& out) {
+    if (!used_replay) {
+        out << "No loop pass was replayed (no repeated loop, or the loop never settled); fully emulated." << std::endl;
+        return;
+    }
+    ConversionOptions full_options = options;
+    full_options.loop_replay = false;
+    VgmInput input;
+    if (!open_input(input_filename, full_options, input)) return;
+    MidiWriter emulated(options.ticks_per_quarter_note);
+    emulated.set_format(options.midi_format);
+    emulated.get_track(emulated.add_track()).add_tempo_change(0, options.tempo_us);
+    {
+        WonderSwanChip chip(emulated, config, logger, input_filename,
+                            TickClock(options.ticks_per_quarter_note, options.tempo_us));
+        chip.disable_usage_log(); // The replayed run already logs this file
+        run_input(input, chip, full_options);
+        chip.finalize();
+    }
+
+    for (size_t i = 0; i < emulated.get_track_count(); ++i) {
+        if (i >= replayed.get_track_count() ||
+            replayed.get_track(i).get_track_data() != emulated.get_track(i).get_track_data()) {
+            std::cerr << "Warning: Loop replay differs from full emulation in track " << i
+                      << " of " << input_filename << "; using the emulated result." << std::endl;
+            replayed = std::move(emulated);
+            return;
+        }
+    }
+    out << "Loop replay verified against full emulation." << std::endl;
+}
+
+void convert_file(const std::string& input_filename, const std::string& output_filename, const ConversionOptions& options, InstrumentConfig& config, UsageLogger& logger, std::ostream& out = std::cout) {
+    out << "\n--- Converting: " << input_filename << " -> " << output_filename << " ---" << std::endl;
+
+    VgmInput input;
+    if (!open_input(input_filename, options, input)) {
+        std::cerr << "Failed to load or parse VGM file: " << input_filename << std::endl;
+        return;
+    }
+
+    MidiWriter midi_writer(options.ticks_per_quarter_note);
+    midi_writer.set_format(options.midi_format);
+    SmfStreamWriter stream_writer;
+    if (options.realtime_output) {
+        if (!stream_writer.open(output_filename, options.ticks_per_quarter_note)) {
+            return;
+        }
+        midi_writer.set_sink(&stream_writer);
+    }
+    size_t meta_track_idx = midi_writer.add_track();
+    MidiTrack& meta_track = midi_writer.get_track(meta_track_idx);
+    meta_track.add_tempo_change(0, options.tempo_us);
+
+    WonderSwanChip chip(midi_writer, config, logger, input_filename,
+                        TickClock(options.ticks_per_quarter_note, options.tempo_us));
+
+    bool used_replay = run_input(input, chip, options);
     chip.finalize();
-    midi_writer.write_to_file(output_filename);
-    std::cout << "Successfully converted." << std::endl;
+    if (options.loop_markers) {
+        chip.mark_loop_end();
+    }
+    if (options.verify_loop) {
+        verify_loop_replay(input_filename, midi_writer, used_replay, options, config, logger, out);
+    }
+    if (options.decimation.enabled()) {
+        size_t removed = midi_writer.decimate(options.decimation);
+        out << "Decimation removed " << removed << " pitch bend/controller events." << std::endl;
+    }
+    if (options.optimize_output) {
+        size_t removed = midi_writer.optimize();
+        out << "Optimizer removed " << removed << " redundant events." << std::endl;
+    }
+    if (options.realtime_output) {
+        if (!stream_writer.finish(midi_writer.get_end_time())) {
+            std::cerr << "Failed to write MIDI stream: " << output_filename << std::endl;
+            return;
+        }
+    } else if (!midi_writer.write_to_file(output_filename)) {
+        std::cerr << "Failed to write MIDI file: " << output_filename << std::endl;
+        return;
+    }
+    config.flush(); // Persist waveforms discovered in this file
+    out << "Successfully converted." << std::endl;
 
     // Logging is now handled internally by chip's destructor calling flush_log()
 }
@@ -117,24 +256,115 @@ void convert_file(const std::string& input_filename, const std::string& output_f
 int main(int argc, char* argv[]) {
     if (argc < 2) {
         std::cerr << "Usage: " << argv[0] << " [options] <input.vgm> <output.mid>" << std::endl;
-        std::cerr << "       " << argv[0] << " -b (batch convert all .vgm in current directory)" << std::endl;
+        std::cerr << "       " << argv[0] << " -b (batch convert all .vgm/.vgz in current directory)" << std::endl;
         std::cerr << "       " << argv[0] << " -s (sort instruments.ini)" << std::endl;
         std::cerr << "Options:" << std::endl;
         std::cerr << "  -l <loops> : Number of loops to play (default: 2)" << std::endl;
+        std::cerr << "  -j <jobs>  : Parallel jobs for batch mode (default: 1, 0 = all cores)" << std::endl;
+        std::cerr << "  --stream   : Decode the input with bounded memory (for very long logs)" << std::endl;
+        std::cerr << "  -f <0|1>   : MIDI file format: 0 = single merged track, 1 = one track per channel (default: 1)" << std::endl;
+        std::cerr << "  -O         : Remove redundant controller and pitch bend events (smaller files)" << std::endl;
+        std::cerr << "  --realtime : Write a Format 0 MIDI stream while converting (output '-' = stdout)" << std::endl;
+        std::cerr << "  --match-threshold <n> : Reuse a known instrument for rotated or offset waveforms, or ones differing in at most n samples (0-6, default: 6, 0 = exact only)" << std::endl;
+        std::cerr << "  --ppq <n>          : MIDI ticks per quarter note (default: 480)" << std::endl;
+        std::cerr << "  --bpm <bpm>        : Tempo written to the file (default: 120)" << std::endl;
+        std::cerr << "  --loop-replay      : Copy repeating loop passes instead of emulating them again" << std::endl;
+        std::cerr << "  --verify-loop      : Like --loop-replay, but also check the result against a full emulation" << std::endl;
+        std::cerr << "  --loop-markers     : Write the loop once, between CC111/loopStart and loopEnd markers" << std::endl;
+        std::cerr << "  --min-ticks <n>    : Keep pitch bend/controller changes at least n ticks apart" << std::endl;
+        std::cerr << "  --min-cents <c>    : Drop pitch bends that move less than c cents" << std::endl;
+        std::cerr << "  --rdp-cents <c>    : Simplify pitch bend curves to within c cents (Ramer-Douglas-Peucker)" << std::endl;
+        std::cerr << "  --min-cc-delta <n> : Drop controller changes smaller than n" << std::endl;
         return 1;
     }
 
     std::vector<std::string> args(argv, argv + argc);
-    int num_loops = 2;
+    ConversionOptions options;
+    int num_jobs = 1;
+    int match_threshold = WaveformIndex::MAX_DISTANCE;
     std::string input_filename, output_filename;
     std::string mode;
+    bool loops_given = false;
 
     for (size_t i = 1; i < args.size(); ++i) {
         if (args[i] == "-l") {
             if (i + 1 < args.size()) {
-                num_loops = std::stoi(args[i + 1]);
+                options.num_loops = std::stoi(args[i + 1]);
+                loops_given = true;
                 i++; // Skip next argument
             }
+        } else if (args[i] == "-j") {
+            if (i + 1 < args.size()) {
+                num_jobs = std::stoi(args[i + 1]);
+                i++;
+            }
+        } else if (args[i] == "-f") {
+            if (i + 1 < args.size()) {
+                int format = std::stoi(args[i + 1]);
+                if (format != 0 && format != 1) {
+                    std::cerr << "Error: -f expects 0 or 1." << std::endl;
+                    return 1;
+                }
+                options.midi_format = static_cast<uint16_t>(format);
+                i++;
+            }
+        } else if (args[i] == "--min-ticks" || args[i] == "--min-cents" ||
+                   args[i] == "--rdp-cents" || args[i] == "--min-cc-delta") {
+            if (i + 1 < args.size()) {
+                double value = std::stod(args[i + 1]);
+                if (value < 0) {
+                    std::cerr << "Error: " << args[i] << " expects a non-negative value." << std::endl;
+                    return 1;
+                }
+                if (args[i] == "--min-ticks") options.decimation.min_ticks = static_cast<uint32_t>(value);
+                else if (args[i] == "--min-cents") options.decimation.min_cents = value;
+                else if (args[i] == "--rdp-cents") options.decimation.rdp_cents = value;
+                else options.decimation.min_cc_delta = static_cast<int>(value);
+                i++;
+            }
+        } else if (args[i] == "-O") {
+            options.optimize_output = true;
+        } else if (args[i] == "--match-threshold") {
+            if (i + 1 < args.size()) {
+                match_threshold = std::stoi(args[i + 1]);
+                if (match_threshold < 0 || match_threshold > WaveformIndex::MAX_DISTANCE) {
+                    std::cerr << "Error: --match-threshold expects a value from 0 to " << WaveformIndex::MAX_DISTANCE << "." << std::endl;
+                    return 1;
+                }
+                i++;
+            }
+        } else if (args[i] == "--ppq") {
+            if (i + 1 < args.size()) {
+                int ppq = std::stoi(args[i + 1]);
+                if (ppq < 1 || ppq > 32767) {
+                    std::cerr << "Error: --ppq expects a value from 1 to 32767." << std::endl;
+                    return 1;
+                }
+                options.ticks_per_quarter_note = static_cast<uint16_t>(ppq);
+                i++;
+            }
+        } else if (args[i] == "--bpm") {
+            if (i + 1 < args.size()) {
+                double bpm = std::stod(args[i + 1]);
+                // The tempo meta event stores whole microseconds in 24 bits.
+                if (!(bpm >= 4.0 && bpm <= 1000.0)) {
+                    std::cerr << "Error: --bpm expects a value from 4 to 1000." << std::endl;
+                    return 1;
+                }
+                options.tempo_us = static_cast<uint32_t>(std::lround(60000000.0 / bpm));
+                i++;
+            }
+        } else if (args[i] == "--loop-replay") {
+            options.loop_replay = true;
+        } else if (args[i] == "--verify-loop") {
+            options.loop_replay = true;
+            options.verify_loop = true;
+        } else if (args[i] == "--loop-markers") {
+            options.loop_markers = true;
+        } else if (args[i] == "--stream") {
+            options.stream_input = true;
+        } else if (args[i] == "--realtime") {
+            options.realtime_output = true;
         } else if (args[i] == "-b" || args[i] == "-s") {
             mode = args[i];
         } else if (input_filename.empty()) {
@@ -144,6 +374,46 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    if (options.realtime_output && options.optimize_output) {
+        std::cerr << "Warning: -O has no effect with --realtime (events are written as they are generated)." << std::endl;
+        options.optimize_output = false;
+    }
+    if (options.realtime_output && options.decimation.enabled()) {
+        std::cerr << "Warning: decimation has no effect with --realtime (events are written as they are generated)." << std::endl;
+        options.decimation = DecimationSettings();
+    }
+    TickClock time_base(options.ticks_per_quarter_note, options.tempo_us);
+    if (!time_base.frames_are_whole_ticks()) {
+        std::cerr << "Warning: A 60 Hz frame is " << time_base.ticks_per_frame()
+                  << " ticks at this PPQ/tempo, so note timing jitters by up to one tick." << std::endl;
+    }
+    // Event times are 64-bit, but a MIDI file cannot hold a delta time above
+    // MidiTrack::MAX_DELTA_TIME, so a long silence on one channel can still fail.
+    double max_gap_minutes = MidiTrack::MAX_DELTA_TIME / (time_base.ticks_per_frame() * 60.0) / 60.0;
+    if (max_gap_minutes < 60.0) {
+        std::cerr << "Warning: At this PPQ/tempo a MIDI file cannot hold a gap of more than "
+                  << static_cast<int>(max_gap_minutes) << " minutes between two events of a channel;"
+                  << " such inputs fail to convert." << std::endl;
+    }
+    if (options.loop_markers) {
+        // The markers replace unrolling: the intro and one loop pass are written.
+        if (loops_given && options.num_loops != 0) {
+            std::cerr << "Warning: -l has no effect with --loop-markers (the loop is written once between markers)." << std::endl;
+        }
+        if (options.loop_replay) {
+            std::cerr << "Warning: " << (options.verify_loop ? "--verify-loop" : "--loop-replay")
+                      << " has no effect with --loop-markers (no loop pass is repeated)." << std::endl;
+        }
+        options.num_loops = 0;
+        options.loop_replay = false;
+        options.verify_loop = false;
+    }
+    if (options.realtime_output && options.loop_replay) {
+        std::cerr << "Warning: loop replay has no effect with --realtime (events are not kept for copying)." << std::endl;
+        options.loop_replay = false;
+        options.verify_loop = false;
+    }
+
     if (mode.empty() && (input_filename.empty() || output_filename.empty())) {
         std::cerr << "Usage: " << argv[0] << " [options] <input.vgm> <output.mid>" << std::endl;
         return 1;
@@ -157,25 +427,73 @@ int main(int argc, char* argv[]) {
     UsageLogger logger(log_path.string());
     InstrumentConfig config(config_path.string(), logger);
     config.load();
+    config.set_match_threshold(match_threshold);
 
     if (mode == "-b") {
         std::cout << "--- Batch conversion mode ---" << std::endl;
         fs::path current_dir = ".";
+        std::vector<std::string> input_files;
         for (const auto& entry : fs::directory_iterator(current_dir)) {
-            if (entry.is_regular_file() && entry.path().extension() == ".vgm") {
-                fs::path input_path = entry.path();
-                fs::path output_path = input_path;
+            if (entry.is_regular_file() && (entry.path().extension() == ".vgm" || entry.path().extension() == ".vgz")) {
+                input_files.push_back(entry.path().string());
+            }
+        }
+        // directory_iterator order is unspecified; sort for reproducible runs.
+        std::sort(input_files.begin(), input_files.end());
+
+        if (num_jobs <= 0) {
+            num_jobs = std::max(1u, std::thread::hardware_concurrency());
+        }
+        num_jobs = std::min<int>(num_jobs, std::max<size_t>(1, input_files.size()));
+
+        if (num_jobs == 1) {
+            for (const auto& input_file : input_files) {
+                fs::path output_path = input_file;
+                output_path.replace_extension(".mid");
+                convert_file(input_file, output_path.string(), options, config, logger);
+            }
+        } else {
+            std::cout << "Using " << num_jobs << " parallel jobs." << std::endl;
+            // Each job owns its MidiWriter/WonderSwanChip; only the config and logger are shared.
+            // Console output is buffered per file so reports do not interleave.
+            // New waveforms are registered afterwards in input order, so instruments.ini
+            // and the log come out the same as with -j 1.
+            std::mutex console_mutex;
+            config.begin_deferred();
+            logger.begin_deferred();
+            {
+                ThreadPool pool(num_jobs);
+                for (const auto& input_file : input_files) {
+                    pool.submit([&, input_file] {
+                        fs::path output_path = input_file;
+                        output_path.replace_extension(".mid");
+                        std::ostringstream out;
+                        convert_file(input_file, output_path.string(), options, config, logger, out);
+                        std::lock_guard<std::mutex> lock(console_mutex);
+                        std::cout << out.str() << std::flush;
+                    });
+                }
+                pool.wait_idle();
+            }
+            // A waveform may resolve differently once earlier files have registered theirs.
+            for (const auto& input_file : config.end_deferred(input_files)) {
+                fs::path output_path = input_file;
                 output_path.replace_extension(".mid");
-                convert_file(input_path.string(), output_path.string(), num_loops, config, logger);
+                std::cout << "\nInstruments changed in input order; converting again." << std::endl;
+                convert_file(input_file, output_path.string(), options, config, logger);
             }
+            logger.end_deferred(config);
         }
+        config.flush();
         std::cout << "\n--- Batch conversion finished ---" << std::endl;
     } else if (mode == "-s") {
         std::cout << "Sorting instruments.ini by similarity..." << std::endl;
         config.sort_and_save();
         std::cout << "instruments.ini has been sorted." << std::endl;
     } else {
-        convert_file(input_filename, output_filename, num_loops, config, logger);
+        // When the MIDI stream goes to stdout, progress messages must not mix into it.
+        bool midi_on_stdout = options.realtime_output && output_filename == "-";
+        convert_file(input_filename, output_filename, options, config, logger, midi_on_stdout ? std::cerr : std::cout);
     }
 
     return 0;
@@ -0,0 +1,80 @@
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "test_support.h"
+
+// Runs a batch conversion with -j 1 and with -j 4, each in its own copy of
+// the converter and the .vgm/.vgz files, starting from a fresh
+// instruments.ini. Both runs must register the same instruments under the
+// same names and write the same log and MIDI files. Lines holding the time
+// of the run are left out of the comparison.
+
+static std::string read_compared(const fs::path& path, bool skip_times) {
+    if (!skip_times) return read_file(path);
+    std::ifstream file(path, std::ios::binary);
+    std::string text, line;
+    while (std::getline(file, line)) {
+        if (line.rfind("registered_at", 0) == 0 || line.rfind("Timestamp:", 0) == 0) continue;
+        text += line + "\n";
+    }
+    return text;
+}
+
+static bool run_batch(const fs::path& converter, const std::vector<fs::path>& inputs, const fs::path& dir, int jobs) {
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    fs::path exe = copy_converter(converter, dir);
+    for (const auto& input : inputs) {
+        fs::copy_file(input, dir / input.filename());
+    }
+    return run_converter(exe, dir, "-b -j " + std::to_string(jobs), "batch_output.txt");
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 3) {
+        std::cerr << "Usage: " << argv[0] << " <vgm2mid> <directory with .vgm files>" << std::endl;
+        return 1;
+    }
+    fs::path converter = fs::absolute(argv[1]);
+    std::vector<fs::path> inputs;
+    for (const auto& entry : fs::directory_iterator(argv[2])) {
+        if (entry.path().extension() == ".vgm" || entry.path().extension() == ".vgz") {
+            inputs.push_back(entry.path());
+        }
+    }
+    if (inputs.size() < 2) {
+        std::cerr << "FAIL: need at least two input files in " << argv[2] << std::endl;
+        return 1;
+    }
+
+    fs::path work = fs::temp_directory_path() / "vgm2mid_batch_jobs_test";
+    fs::path serial = work / "j1";
+    fs::path parallel = work / "j4";
+    if (!run_batch(converter, inputs, serial, 1) || !run_batch(converter, inputs, parallel, 4)) {
+        std::cerr << "FAIL: batch conversion did not run; see batch_output.txt in " << work << std::endl;
+        return 1;
+    }
+
+    std::vector<std::pair<std::string, bool>> compared = {
+        {"instruments.ini", true}, {"conversion_log.txt", true}};
+    for (const auto& input : inputs) {
+        compared.emplace_back(fs::path(input.filename()).replace_extension(".mid").string(), false);
+    }
+    int failures = 0;
+    for (const auto& file : compared) {
+        if (!fs::exists(serial / file.first) ||
+            read_compared(serial / file.first, file.second) != read_compared(parallel / file.first, file.second)) {
+            std::cerr << "FAIL: " << file.first << " differs between -j 1 and -j 4" << std::endl;
+            failures++;
+        }
+    }
+    if (failures > 0) {
+        std::cerr << "Outputs kept in " << work << std::endl;
+        return 1;
+    }
+
+    fs::remove_all(work);
+    std::cout << "PASS: -j 1 and -j 4 agree on " << compared.size() << " files." << std::endl;
+    return 0;
+}
@@ -0,0 +1,100 @@
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "test_support.h"
+
+// Writes a small WonderSwan VGM whose loop offset points into the middle of
+// a port write, then converts it with and without --stream. Both decoders
+// must start the loop at the next command, so the MIDI files must match and
+// --loop-markers must place a loopStart marker.
+
+static void port_write(std::vector<uint8_t>& data, uint8_t port, uint8_t value) {
+    data.insert(data.end(), {0xBC, static_cast<uint8_t>(port - 0x80), value});
+}
+
+static void wait_frame(std::vector<uint8_t>& data) {
+    data.push_back(0x62); // 735 samples
+}
+
+static std::vector<uint8_t> build_vgm(uint32_t& loop_offset) {
+    std::vector<uint8_t> data(0x40, 0);
+    data[0] = 'V'; data[1] = 'g'; data[2] = 'm'; data[3] = ' ';
+    data[0x34] = 0x0C; // Commands start at 0x40
+
+    // A sawtooth in channel 1's wavetable, then a held note.
+    port_write(data, 0x8F, 0x00);
+    for (int i = 0; i < 16; ++i) {
+        data.insert(data.end(), {0xC6, 0x00, static_cast<uint8_t>(i), static_cast<uint8_t>(i | (i << 4))});
+    }
+    port_write(data, 0x80, 0x00);
+    port_write(data, 0x81, 0x07);
+    port_write(data, 0x88, 0xFF);
+    port_write(data, 0x90, 0x01);
+    wait_frame(data);
+
+    // The loop: the header points at the value byte of the first write.
+    loop_offset = static_cast<uint32_t>(data.size()) + 2;
+    for (uint8_t low : {0x40, 0x80, 0xC0, 0x00}) {
+        port_write(data, 0x80, low);
+        port_write(data, 0x88, low == 0x00 ? 0x88 : 0xFF);
+        wait_frame(data);
+        wait_frame(data);
+    }
+    data.push_back(0x66);
+
+    uint32_t relative = loop_offset - 0x1C;
+    for (int i = 0; i < 4; ++i) data[0x1C + i] = static_cast<uint8_t>(relative >> (8 * i));
+    return data;
+}
+
+static bool convert(const fs::path& exe, const fs::path& dir, const std::string& options, const std::string& output) {
+    return run_converter(exe, dir, options + " loop.vgm " + output, output + ".txt") && fs::exists(dir / output);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 2) {
+        std::cerr << "Usage: " << argv[0] << " <vgm2mid>" << std::endl;
+        return 1;
+    }
+    fs::path converter = fs::absolute(argv[1]);
+    fs::path work = fs::temp_directory_path() / "vgm2mid_stream_loop_test";
+    fs::remove_all(work);
+    fs::create_directories(work);
+    fs::path exe = copy_converter(converter, work);
+
+    uint32_t loop_offset;
+    std::vector<uint8_t> vgm = build_vgm(loop_offset);
+    std::ofstream(work / "loop.vgm", std::ios::binary).write(reinterpret_cast<const char*>(vgm.data()), vgm.size());
+
+    const std::vector<std::string> cases = {"-l 2", "-l 2 --loop-markers", "-l 3 --loop-replay"};
+    int failures = 0;
+    for (size_t i = 0; i < cases.size(); ++i) {
+        std::string in_memory = "memory" + std::to_string(i) + ".mid";
+        std::string streamed = "stream" + std::to_string(i) + ".mid";
+        if (!convert(exe, work, cases[i], in_memory) || !convert(exe, work, cases[i] + " --stream", streamed)) {
+            std::cerr << "FAIL: conversion failed for '" << cases[i] << "'" << std::endl;
+            failures++;
+            continue;
+        }
+        std::string expected = read_file(work / in_memory);
+        if (expected != read_file(work / streamed)) {
+            std::cerr << "FAIL: '" << cases[i] << "' differs with --stream" << std::endl;
+            failures++;
+        }
+        if (cases[i].find("--loop-markers") != std::string::npos && expected.find("loopStart") == std::string::npos) {
+            std::cerr << "FAIL: '" << cases[i] << "' has no loopStart marker" << std::endl;
+            failures++;
+        }
+    }
+    if (failures > 0) {
+        std::cerr << "Outputs kept in " << work << std::endl;
+        return 1;
+    }
+
+    fs::remove_all(work);
+    std::cout << "PASS: loop offset 0x" << std::hex << loop_offset << std::dec
+              << " inside a command handled the same with --stream in " << cases.size() << " cases." << std::endl;
+    return 0;
+}
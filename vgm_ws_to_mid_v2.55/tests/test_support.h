@@ -0,0 +1,37 @@
+#ifndef TEST_SUPPORT_H
+#define TEST_SUPPORT_H
+
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+// Helpers shared by the tests that run the converter as a separate program.
+
+namespace fs = std::filesystem;
+
+inline std::string read_file(const fs::path& path) {
+    std::ifstream file(path, std::ios::binary);
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    return contents.str();
+}
+
+// Copies the converter into `dir` and returns the copy. The converter keeps
+// instruments.ini next to itself, so a private copy never touches the real one.
+inline fs::path copy_converter(const fs::path& converter, const fs::path& dir) {
+    fs::path exe = dir / converter.filename();
+    fs::copy_file(converter, exe, fs::copy_options::overwrite_existing);
+    return exe;
+}
+
+// Runs `exe arguments` inside `dir` with stdout and stderr going to
+// `dir/log`. Returns true if it exited with status 0.
+inline bool run_converter(const fs::path& exe, const fs::path& dir, const std::string& arguments, const std::string& log) {
+    std::string command = "cd \"" + dir.string() + "\" && \"" + exe.string() + "\" " + arguments +
+                          " > " + log + " 2>&1";
+    return std::system(command.c_str()) == 0;
+}
+
+#endif // TEST_SUPPORT_H
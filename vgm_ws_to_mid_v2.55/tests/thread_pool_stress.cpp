@@ -0,0 +1,51 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <future>
+#include <iostream>
+#include <thread>
+#include "../ThreadPool.h"
+
+// Submits many trivial tasks from a separate thread while the workers are
+// live, so tasks are often taken and finished before submit() returns.
+// A holder task keeps the pool busy until the producer is done, so a single
+// wait_idle() may only return once every task has run. If the task counters
+// get out of step, wait_idle() either returns early or never returns.
+int main() {
+    const int rounds = 500;
+    const int tasks_per_round = 2000;
+
+    ThreadPool pool(4);
+    for (int round = 0; round < rounds; ++round) {
+        std::atomic<int> completed{0};
+        std::atomic<bool> producer_done{false};
+
+        pool.submit([&] {
+            while (!producer_done.load()) std::this_thread::yield();
+            completed.fetch_add(1);
+        });
+        auto waiter = std::async(std::launch::async, [&pool] { pool.wait_idle(); });
+        std::thread producer([&] {
+            for (int i = 0; i < tasks_per_round; ++i) {
+                pool.submit([&completed] { completed.fetch_add(1); });
+            }
+            producer_done.store(true);
+        });
+
+        if (waiter.wait_for(std::chrono::seconds(10)) != std::future_status::ready) {
+            std::cerr << "FAIL: wait_idle() did not return in round " << round << std::endl;
+            std::_Exit(1); // The waiter is stuck; the pool cannot be shut down cleanly.
+        }
+        int done_at_return = completed.load();
+        producer.join();
+        pool.wait_idle();
+        if (done_at_return != tasks_per_round + 1) {
+            std::cerr << "FAIL: wait_idle() returned in round " << round << " after "
+                      << done_at_return << " of " << tasks_per_round + 1 << " tasks" << std::endl;
+            return 1;
+        }
+    }
+
+    std::cout << "PASS: " << rounds * (tasks_per_round + 1) << " tasks completed." << std::endl;
+    return 0;
+}
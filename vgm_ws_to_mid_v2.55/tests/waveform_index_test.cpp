@@ -0,0 +1,166 @@
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include "../WaveFingerprint.h"
+#include "../WaveformIndex.h"
+
+// Checks WaveformIndex::find_nearest() and find_within() against a plain
+// scan over every entry, for random waveforms and for waveforms a few
+// samples away from known ones, at every search distance up to and past
+// MAX_DISTANCE. Also checks that WaveFingerprint::canonical() gives the same
+// result for every rotation and DC offset of a waveform, and that it picks
+// the smallest rotation.
+
+static std::mt19937 rng(12345);
+
+static WaveFingerprint random_wave() {
+    std::array<uint8_t, 32> samples;
+    for (uint8_t& sample : samples) sample = static_cast<uint8_t>(rng() & 0x0F);
+    return WaveFingerprint::from_samples(samples);
+}
+
+// Changes `count` distinct samples of `wave` to a different value.
+static WaveFingerprint perturb(const WaveFingerprint& wave, int count) {
+    std::array<uint8_t, 32> samples = wave.to_samples();
+    std::array<uint8_t, 32> order;
+    for (size_t i = 0; i < order.size(); ++i) order[i] = static_cast<uint8_t>(i);
+    std::shuffle(order.begin(), order.end(), rng);
+    for (int i = 0; i < count; ++i) {
+        uint8_t& sample = samples[order[i]];
+        sample = static_cast<uint8_t>((sample + 1 + rng() % 15) & 0x0F);
+    }
+    return WaveFingerprint::from_samples(samples);
+}
+
+static bool check_queries(const WaveformIndex& index, const std::vector<WaveFingerprint>& waves,
+                          const std::vector<std::string>& names, const std::vector<WaveFingerprint>& queries) {
+    int failures = 0;
+    std::vector<uint32_t> found;
+    for (const WaveFingerprint& query : queries) {
+        for (int max_distance = -1; max_distance <= WaveformIndex::MAX_DISTANCE + 2; ++max_distance) {
+            int limit = std::min(max_distance, WaveformIndex::MAX_DISTANCE);
+            std::vector<uint32_t> expected;
+            int best = -1;
+            for (size_t i = 0; i < waves.size(); ++i) {
+                int d = WaveformIndex::distance(query, waves[i]);
+                if (d > limit) continue;
+                expected.push_back(static_cast<uint32_t>(i));
+                int best_d = best < 0 ? limit + 1 : WaveformIndex::distance(query, waves[best]);
+                if (d < best_d || (d == best_d && names[i] < names[best])) best = static_cast<int>(i);
+            }
+
+            index.find_within(query, max_distance, found);
+            if (found != expected) {
+                std::cerr << "FAIL: find_within(" << query.to_hex() << ", " << max_distance << ") returned "
+                          << found.size() << " entries, expected " << expected.size() << std::endl;
+                failures++;
+            }
+            WaveFingerprint match;
+            bool matched = index.find_nearest(query, max_distance, match);
+            if (matched != (best >= 0) || (matched && match != waves[best])) {
+                std::cerr << "FAIL: find_nearest(" << query.to_hex() << ", " << max_distance << ") returned "
+                          << (matched ? match.to_hex() : "nothing") << ", expected "
+                          << (best >= 0 ? waves[best].to_hex() : "nothing") << std::endl;
+                failures++;
+            }
+            if (failures > 10) return false;
+        }
+    }
+    return failures == 0;
+}
+
+static bool test_index() {
+    // Random waveforms, and clusters of waveforms close to one another so
+    // that nearest-neighbour ties and several matches per query are common.
+    std::vector<WaveFingerprint> waves;
+    for (int i = 0; i < 1500; ++i) waves.push_back(random_wave());
+    for (int cluster = 0; cluster < 50; ++cluster) {
+        WaveFingerprint base = random_wave();
+        waves.push_back(base);
+        for (int i = 0; i < 20; ++i) waves.push_back(perturb(base, 1 + static_cast<int>(rng() % 8)));
+    }
+    waves.push_back(waves[7]); // The same waveform under two names
+
+    // Names in an order unrelated to insertion order, so ties are broken by name.
+    std::vector<std::string> names;
+    for (size_t i = 0; i < waves.size(); ++i) names.push_back("Wave" + std::to_string(i));
+    std::shuffle(names.begin(), names.end(), rng);
+
+    WaveformIndex index;
+    for (size_t i = 0; i < waves.size(); ++i) index.add(waves[i], names[i]);
+
+    std::vector<WaveFingerprint> queries;
+    for (int i = 0; i < 200; ++i) queries.push_back(random_wave());
+    for (int i = 0; i < 600; ++i) {
+        const WaveFingerprint& known = waves[rng() % waves.size()];
+        queries.push_back(perturb(known, static_cast<int>(rng() % (WaveformIndex::MAX_DISTANCE + 3))));
+    }
+    return check_queries(index, waves, names, queries);
+}
+
+static WaveFingerprint rotate_and_offset(const WaveFingerprint& wave, size_t rotation, int offset) {
+    std::array<uint8_t, 32> samples = wave.to_samples();
+    std::rotate(samples.begin(), samples.begin() + rotation, samples.end());
+    for (uint8_t& sample : samples) sample = static_cast<uint8_t>(sample + offset);
+    return WaveFingerprint::from_samples(samples);
+}
+
+// The smallest of all 32 rotations after moving the lowest sample to 0.
+static WaveFingerprint brute_force_canonical(const WaveFingerprint& wave) {
+    std::array<uint8_t, 32> samples = wave.to_samples();
+    uint8_t lowest = *std::min_element(samples.begin(), samples.end());
+    WaveFingerprint best;
+    for (size_t rotation = 0; rotation < samples.size(); ++rotation) {
+        WaveFingerprint candidate = rotate_and_offset(wave, rotation, -lowest);
+        if (rotation == 0 || candidate < best) best = candidate;
+    }
+    return best;
+}
+
+static bool test_canonical() {
+    std::vector<WaveFingerprint> waves;
+    for (int i = 0; i < 300; ++i) {
+        // Narrow ranges leave room for DC offsets.
+        std::array<uint8_t, 32> samples;
+        int range = 1 + static_cast<int>(rng() % 16);
+        for (uint8_t& sample : samples) sample = static_cast<uint8_t>(rng() % range);
+        waves.push_back(WaveFingerprint::from_samples(samples));
+    }
+    // Periodic and flat waveforms, where several rotations tie.
+    for (size_t period : {1, 2, 4, 8, 16}) {
+        std::array<uint8_t, 32> samples;
+        for (size_t i = 0; i < samples.size(); ++i) samples[i] = static_cast<uint8_t>((i % period) * 3 % 7);
+        waves.push_back(WaveFingerprint::from_samples(samples));
+    }
+    waves.push_back(perturb(WaveFingerprint(), 1)); // A single spike
+
+    int failures = 0;
+    for (const WaveFingerprint& wave : waves) {
+        WaveFingerprint expected = brute_force_canonical(wave);
+        std::array<uint8_t, 32> samples = wave.to_samples();
+        int headroom = 15 - *std::max_element(samples.begin(), samples.end());
+        for (size_t rotation = 0; rotation < samples.size(); ++rotation) {
+            for (int offset = 0; offset <= headroom; ++offset) {
+                WaveFingerprint variant = rotate_and_offset(wave, rotation, offset);
+                if (variant.canonical() != expected) {
+                    std::cerr << "FAIL: canonical(" << variant.to_hex() << ") is " << variant.canonical().to_hex()
+                              << ", expected " << expected.to_hex() << std::endl;
+                    if (++failures > 10) return false;
+                }
+            }
+        }
+    }
+    return failures == 0;
+}
+
+int main() {
+    bool index_ok = test_index();
+    bool canonical_ok = test_canonical();
+    if (!index_ok || !canonical_ok) return 1;
+    std::cout << "PASS: WaveformIndex matches a full scan and canonical() is rotation/offset invariant." << std::endl;
+    return 0;
+}